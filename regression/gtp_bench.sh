@@ -0,0 +1,39 @@
+#!/bin/sh
+# Commands per second of the GTP loop, run through gtpfile on scripted
+# workloads: cheap commands that measure the dispatch and play/undo
+# pairs that measure the board and tree sync.
+# Usage: gtp_bench.sh [dispatch commands]   (ENGINE overrides bin/engine)
+ROOT="$(readlink -f $(dirname "$0"))/.."
+ENGINE="${ENGINE:-${ROOT}/bin/engine}"
+COUNT="${1:-200000}"
+WORKLOAD="$(mktemp)"
+
+# bench name count lines...  - repeats the lines up to count commands
+bench () {
+  NAME="$1"
+  N="$2"
+  shift 2
+  i=0
+  while test $i -lt "${N}"; do
+    for line in "$@"; do echo "${line}"; done
+    i=$((i + $#))
+  done > "${WORKLOAD}"
+  echo "${NAME}: $("${ENGINE}" "gtpfile ${WORKLOAD}" quit 2>&1 >/dev/null | grep "^gtpfile:")"
+}
+
+bench dispatch "${COUNT}" \
+  "showboard" \
+  "known_command genmove" \
+  "param.other genmove_playouts" \
+  "param.other genmove_playouts 20000" \
+  "komi 6.5" \
+  "protocol_version" \
+  "7 name # comment"
+
+bench play "$((COUNT / 20))" \
+  "play b D4" \
+  "play w E5" \
+  "undo" \
+  "undo"
+
+rm -f "${WORKLOAD}"
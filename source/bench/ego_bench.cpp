@@ -0,0 +1,467 @@
+//
+// Copyright 2006 and onwards, Lukasz Lew
+//
+
+// Fixed benchmark suite, results as JSON (to a file given as the only
+// argument, or to stdout). Each case runs kWarmupReps + kReps
+// repetitions of a batch of operations; the reported numbers are
+// CC per operation over the kReps measured repetitions, and hardware
+// counters per operation when PerfCounters has them.
+//
+// Board size is fixed at compile time, there is one executable per
+// size (ego_bench, ego_bench_13, ...).
+
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+
+#include "ego.hpp"
+#include "mcts_tree.hpp"
+
+namespace {
+
+  const uint kWarmupReps = 3;
+  const uint kReps = 15;
+
+  // About the same work per repetition on all board sizes.
+  const uint kPlayoutsPerRep = 40000 / Board::kArea;
+  const uint kPositionCount = 64;
+
+  struct Result {
+    string name;
+    string unit;
+    uint   ops_per_rep;
+    vector <double> cc_per_op;
+    double total_ops;
+    double events [PerfCounters::kEventCount]; // sums over measured reps
+  };
+
+  double CcPerSecond () {
+    double wall_begin = WallTime ();
+    uint64 cc_begin = FastTimer::GetCcTime ();
+    while (WallTime () - wall_begin < 0.1) {}
+    return (FastTimer::GetCcTime () - cc_begin) / (WallTime () - wall_begin);
+  }
+
+  // Nearest rank, q in [0, 1].
+  double Quantile (vector <double> samples, double q) {
+    sort (samples.begin (), samples.end ());
+    uint rank = uint (ceil (q * samples.size ()));
+    return samples [max (rank, 1u) - 1];
+  }
+
+  PerfCounters* counters;
+
+  // Body returns the number of operations it did and the CC it spent
+  // on them (to leave out the setup between timed parts). Hardware
+  // counters cover the whole body, setup included.
+  template <typename Body>
+  Result Measure (const string& name, const string& unit, Body& body) {
+    Result result;
+    result.name = name;
+    result.unit = unit;
+    result.ops_per_rep = 0;
+    result.total_ops = 0.0;
+    counters->Reset ();
+    rep (rr, kWarmupReps + kReps) {
+      double cc = 0.0;
+      if (rr >= kWarmupReps) counters->Start ();
+      uint ops = body (&cc);
+      if (rr < kWarmupReps) continue;
+      counters->Stop ();
+      result.ops_per_rep = ops;
+      result.total_ops += ops;
+      result.cc_per_op.push_back (cc / ops);
+    }
+    rep (ii, PerfCounters::kEventCount) {
+      result.events [ii] = counters->Count (PerfCounters::Event (ii));
+    }
+    return result;
+  }
+
+  // -----------------------------------------------------------------------------
+
+  Board empty_board;
+
+  void LightPlayout (Board& board, FastRandom& random) {
+    board.Load (empty_board);
+    while (!board.BothPlayerPass ()) {
+      Player pl = board.ActPlayer ();
+      board.PlayLegal (pl, board.RandomLightMove (pl, random));
+    }
+  }
+
+  // Positions with at most a quarter of the board empty.
+  void LateGamePositions (vector <Board>& positions, FastRandom& random) {
+    uint ii = 0;
+    while (ii < positions.size ()) {
+      Board& board = positions [ii];
+      board.Load (empty_board);
+      while (!board.BothPlayerPass () &&
+             board.EmptyVertexCount () > Board::kArea / 4) {
+        Player pl = board.ActPlayer ();
+        board.PlayLegal (pl, board.RandomLightMove (pl, random));
+      }
+      if (!board.BothPlayerPass ()) ii++;
+    }
+  }
+
+  // -----------------------------------------------------------------------------
+
+  struct LightPlayoutBody {
+    Board board;
+    FastRandom random;
+    LightPlayoutBody () : random (123) {}
+
+    uint operator() (double* cc) {
+      uint64 begin = FastTimer::GetCcTime ();
+      rep (ii, kPlayoutsPerRep) LightPlayout (board, random);
+      *cc = FastTimer::GetCcTime () - begin;
+      return kPlayoutsPerRep;
+    }
+  };
+
+  struct GammaPlayoutBody {
+    Board board;
+    Gammas gammas;
+    Sampler sampler;
+    FastRandom random;
+    GammaPlayoutBody () : sampler (board, gammas), random (123) {}
+
+    uint operator() (double* cc) {
+      uint64 begin = FastTimer::GetCcTime ();
+      rep (ii, kPlayoutsPerRep) {
+        board.Load (empty_board);
+        sampler.NewPlayout ();
+        while (!board.BothPlayerPass ()) {
+          Player pl = board.ActPlayer ();
+          board.PlayLegal (pl, sampler.SampleMove (random));
+          sampler.MovePlayed ();
+        }
+      }
+      *cc = FastTimer::GetCcTime () - begin;
+      return kPlayoutsPerRep;
+    }
+  };
+
+  struct IsReallyLegalBody {
+    vector <Board>& positions;
+    uint legal_cnt;
+    explicit IsReallyLegalBody (vector <Board>& positions)
+      : positions (positions), legal_cnt (0) {}
+
+    uint operator() (double* cc) {
+      uint ops = 0;
+      uint64 begin = FastTimer::GetCcTime ();
+      rep (ii, positions.size ()) {
+        const Board& board = positions [ii];
+        ForEachNat (Vertex, v) {
+          if (board.ColorAt (v) != Color::Empty ()) continue;
+          ForEachNat (Player, pl) {
+            legal_cnt += board.IsReallyLegal (Move (pl, v));
+            ops += 1;
+          }
+        }
+      }
+      *cc = FastTimer::GetCcTime () - begin;
+      return ops;
+    }
+  };
+
+  struct LoadBody {
+    vector <Board>& positions;
+    Board board;
+    explicit LoadBody (vector <Board>& positions) : positions (positions) {}
+
+    uint operator() (double* cc) {
+      const uint ops = 100 * positions.size ();
+      uint64 begin = FastTimer::GetCcTime ();
+      rep (ii, ops) board.Load (positions [ii % positions.size ()]);
+      *cc = FastTimer::GetCcTime () - begin;
+      return ops;
+    }
+  };
+
+  struct TrompTaylorBody {
+    vector <Board> finished;
+    int score_sum;
+    TrompTaylorBody () : finished (kPositionCount), score_sum (0) {
+      FastRandom random (123);
+      rep (ii, finished.size ()) LightPlayout (finished [ii], random);
+    }
+
+    uint operator() (double* cc) {
+      const uint ops = 100 * finished.size ();
+      uint64 begin = FastTimer::GetCcTime ();
+      rep (ii, ops) score_sum += finished [ii % finished.size ()].TrompTaylorScore ();
+      *cc = FastTimer::GetCcTime () - begin;
+      return ops;
+    }
+  };
+
+  // FastRandom, sum keeps the values alive.
+  template <int kind>
+  struct RandomBody {
+    FastRandom random;
+    uint sum;
+    vector <uint> buffer;
+    RandomBody () : random (123), sum (0), buffer (4096) {}
+
+    uint operator() (double* cc) {
+      const uint ops = 1 << 20;
+      uint64 begin = FastTimer::GetCcTime ();
+      switch (kind) {
+      case 0: rep (ii, ops) sum += random.GetNextUint (); break;
+      case 1: rep (ii, ops) sum += random.GetNextUint (Board::kArea - ii % 64); break;
+      case 2: rep (ii, ops) sum += random.NextDouble () < 0.5; break;
+      case 3:
+        rep (ii, ops / buffer.size ()) {
+          random.Fill (&buffer [0], buffer.size ());
+          sum += buffer [ii % buffer.size ()];
+        }
+        break;
+      }
+      *cc = FastTimer::GetCcTime () - begin;
+      return ops;
+    }
+  };
+
+  // -----------------------------------------------------------------------------
+
+  // Synthetic tree: all vertices and pass are children of every node,
+  // results are random. Built by the same descent as Engine, with
+  // expansion after ReadyToExpand.
+  class SyntheticTree {
+  public:
+    SyntheticTree () : random (123) {
+      root_stats.Add (Vertex::Any (), 0.0);
+      root = &root_stats.GetNode (Player::White (), 0);
+      root->Reset ();
+      rep (ii, 20000) {
+        Descend (true);
+        Backup ();
+      }
+    }
+
+    ~SyntheticTree () {
+      root->Reset ();
+    }
+
+    // Returns the number of selections.
+    uint Descend (bool expand) {
+      path.clear ();
+      path.push_back (root);
+      MctsNode* node = root;
+      Player pl = Player::Black ();
+      while (true) {
+        if (node->children [pl].Size () == 0) {
+          if (!expand || !node->ReadyToExpand ()) break;
+          ForEachNat (Vertex, v) {
+            if (v.IsOnBoard () || v == Vertex::Pass ()) {
+              node->AddChild (pl, v, random.GetNextUint (1000) / 1000.0);
+            }
+          }
+          node->children [pl].SetComplete ();
+        }
+        node = &node->BestRaveChild (pl);
+        path.push_back (node);
+        pl = pl.Other ();
+      }
+      return path.size () - 1;
+    }
+
+    void Backup () {
+      float score = random.GetNextUint (2) == 0 ? 1.0 : -1.0;
+      rep (ii, path.size ()) path [ii]->UpdateStat (score);
+    }
+
+    MctsChildren root_stats;
+    MctsNode* root;
+    vector <MctsNode*> path;
+    FastRandom random;
+  };
+
+  struct TreeDescentBody {
+    SyntheticTree& tree;
+    FastTimer timer;
+    explicit TreeDescentBody (SyntheticTree& tree) : tree (tree) {
+      timer.overhead = FastTimer::MinOverhead ();
+    }
+
+    uint operator() (double* cc) {
+      uint ops = 0;
+      timer.Reset ();
+      rep (ii, 10000) {
+        timer.Start ();
+        ops += tree.Descend (false);
+        timer.Stop ();
+        tree.Backup ();
+      }
+      *cc = timer.sample_sum;
+      return ops;
+    }
+  };
+
+  // Traces are tree descents followed by recorded light playouts.
+  struct RaveUpdateBody {
+    SyntheticTree& tree;
+    vector <vector <Move> > playouts;
+    MctsTrace trace;
+    FastTimer timer;
+    explicit RaveUpdateBody (SyntheticTree& tree) : tree (tree), playouts (kPositionCount) {
+      timer.overhead = FastTimer::MinOverhead ();
+      FastRandom random (123);
+      Board board;
+      rep (ii, playouts.size ()) {
+        board.Load (empty_board);
+        while (!board.BothPlayerPass ()) {
+          Player pl = board.ActPlayer ();
+          Vertex v = board.RandomLightMove (pl, random);
+          board.PlayLegal (pl, v);
+          playouts [ii].push_back (Move (pl, v));
+        }
+      }
+    }
+
+    uint operator() (double* cc) {
+      const uint ops = 2000;
+      timer.Reset ();
+      rep (ii, ops) {
+        tree.Descend (false);
+        trace.Reset (*tree.root);
+        reps (jj, 1, tree.path.size ()) {
+          trace.NewNode (*tree.path [jj]);
+          trace.NewMove (tree.path [jj]->GetMove ());
+        }
+        const vector <Move>& moves = playouts [ii % playouts.size ()];
+        rep (jj, moves.size ()) trace.NewMove (moves [jj]);
+
+        timer.Start ();
+        trace.UpdateTraceRave (ii % 2 == 0 ? 1.0 : -1.0);
+        timer.Stop ();
+      }
+      *cc = timer.sample_sum;
+      return ops;
+    }
+  };
+
+  // -----------------------------------------------------------------------------
+
+  // Per op, null when not counted.
+  void WriteEvents (ostream& out, const Result& r) {
+    const char* const keys [PerfCounters::kEventCount] = {
+      "cycles", "instructions", "l1d_misses", "llc_misses", "branch_misses"
+    };
+    if (!counters->HasHardware ()) {
+      out << ", \"ipc\": null";
+      return;
+    }
+    char buf [100];
+    sprintf (buf, ", \"ipc\": %.3f",
+             r.events [PerfCounters::Instructions] / r.events [PerfCounters::Cycles]);
+    out << buf;
+    rep (ii, PerfCounters::kEventCount) {
+      out << ", \"" << keys [ii] << "_per_op\": ";
+      if (counters->Has (PerfCounters::Event (ii))) {
+        sprintf (buf, "%.2f", r.events [ii] / r.total_ops);
+        out << buf;
+      } else {
+        out << "null";
+      }
+    }
+  }
+
+  struct RandomQuality {
+    uint   buckets;
+    double chi_square;
+    double serial_correlation;
+  };
+
+  void WriteJson (ostream& out, const vector <Result>& results, double cc_per_second,
+                  const RandomQuality& quality) {
+    char buf [200];
+    out << "{\"board_size\": " << board_size
+        << ", \"hardware_counters\": " << (counters->HasHardware () ? "true" : "false")
+        << ", \"warmup_reps\": " << kWarmupReps
+        << ", \"reps\": " << kReps;
+    sprintf (buf, ", \"cc_per_second\": %.0f,", cc_per_second);
+    out << buf << endl;
+    sprintf (buf, " \"random_quality\": {\"buckets\": %u, \"chi_square\": %.1f, "
+             "\"serial_correlation\": %.6f},",
+             quality.buckets, quality.chi_square, quality.serial_correlation);
+    out << buf << endl << " \"results\": [" << endl;
+    rep (ii, results.size ()) {
+      const Result& r = results [ii];
+      sprintf (buf,
+               "\"median_cc\": %.1f, \"p95_cc\": %.1f, \"min_cc\": %.1f, \"median_ns\": %.2f",
+               Quantile (r.cc_per_op, 0.5),
+               Quantile (r.cc_per_op, 0.95),
+               Quantile (r.cc_per_op, 0.0),
+               Quantile (r.cc_per_op, 0.5) / cc_per_second * 1.0e9);
+      out << "  {\"name\": \"" << r.name << "\", \"unit\": \"" << r.unit
+          << "\", \"ops_per_rep\": " << r.ops_per_rep << ", " << buf;
+      WriteEvents (out, r);
+      out << "}" << (ii + 1 < results.size () ? "," : "") << endl;
+    }
+    out << " ]}" << endl;
+  }
+}
+
+
+int main (int argc, char** argv) {
+  if (argc > 2) {
+    cerr << "usage: " << argv [0] << " [output.json]" << endl;
+    return 1;
+  }
+
+  double cc_per_second = CcPerSecond ();
+  PerfCounters perf_counters;
+  counters = &perf_counters;
+  FastRandom random (123);
+  vector <Board> late_game (kPositionCount);
+  LateGamePositions (late_game, random);
+  SyntheticTree tree;
+
+  LightPlayoutBody light_playout;
+  GammaPlayoutBody gamma_playout;
+  IsReallyLegalBody is_really_legal (late_game);
+  TreeDescentBody tree_descent (tree);
+  RaveUpdateBody rave_update (tree);
+  LoadBody load (late_game);
+  TrompTaylorBody tromp_taylor;
+  RandomBody <0> random_uint;
+  RandomBody <1> random_bounded;
+  RandomBody <2> random_double;
+  RandomBody <3> random_fill;
+
+  vector <Result> results;
+  results.push_back (Measure ("light_playout", "playout", light_playout));
+  results.push_back (Measure ("gamma_playout", "playout", gamma_playout));
+  results.push_back (Measure ("is_really_legal_late", "call", is_really_legal));
+  results.push_back (Measure ("tree_descent", "selection", tree_descent));
+  results.push_back (Measure ("rave_update", "trace", rave_update));
+  results.push_back (Measure ("load", "call", load));
+  results.push_back (Measure ("tromp_taylor_score", "call", tromp_taylor));
+  results.push_back (Measure ("random_uint", "value", random_uint));
+  results.push_back (Measure ("random_bounded", "value", random_bounded));
+  results.push_back (Measure ("random_double", "value", random_double));
+  results.push_back (Measure ("random_fill", "value", random_fill));
+
+  // Chi-square has buckets - 1 degrees of freedom.
+  RandomQuality quality;
+  quality.buckets = 1000;
+  quality.chi_square = random.BucketChiSquare (quality.buckets, 10000000);
+  quality.serial_correlation = random.SerialCorrelation (10000000);
+
+  if (argc == 2) {
+    ofstream out (argv [1]);
+    if (!out.good ()) {
+      cerr << "Can't open a file: " << argv [1] << endl;
+      return 1;
+    }
+    WriteJson (out, results, cc_per_second, quality);
+  } else {
+    WriteJson (cout, results, cc_per_second, quality);
+  }
+  return 0;
+}
@@ -2,27 +2,45 @@
 // Copyright 2006 and onwards, Lukasz Lew
 //
 
+#include <algorithm>
 #include "engine.hpp"
 
+namespace {
+  const std::atomic<bool> never_stop (false);
+}
+
 Engine::Engine () :
   random (TimeSeed()),
-  root (Player::White(), Vertex::Any (), 0.0),
-  sampler (playout_board, gammas)
+  sampler (playout_board, gammas),
+  komi_offset (0.0),
+  playouts_since_report (0),
+  stop_flag (&never_stop)
 {
+  root_stats.Add (Vertex::Any (), 0.0);
+  root = &root_stats.GetNode (Player::White(), 0);
   CHECK (Reset (board_size));
 }
 
 
 bool Engine::Reset (uint board_size) {
-  base_board.Clear ();
-  root.Reset ();
-  base_node = &root; // easy SyncRoot
+  {
+    std::lock_guard<std::mutex> lock (board_mutex);
+    base_board.Clear ();
+  }
+  root->Reset ();
+  base_node = root; // easy SyncRoot
+  komi_offset = 0.0;
+  pv.Rebuild (*base_node, base_board.ActPlayer ());
   return board_size == ::board_size;
 }
 
 
 void Engine::SetKomi (float komi) {
-  base_board.SetKomi (komi);
+  {
+    std::lock_guard<std::mutex> lock (board_mutex);
+    base_board.SetKomi (komi);
+  }
+  komi_offset = 0.0;
 }
 
 
@@ -30,7 +48,10 @@ bool Engine::Play (Move move) {
   CHECK (move.IsValid ());
   bool ok = base_board.IsReallyLegal (move);
   if (ok) {
-    base_board.PlayLegal (move);
+    {
+      std::lock_guard<std::mutex> lock (board_mutex);
+      base_board.PlayLegal (move);
+    }
     SyncRoot ();
     base_board.Dump();
   }
@@ -39,7 +60,11 @@ bool Engine::Play (Move move) {
 
 
 Move Engine::Genmove (Player player) {
-  base_board.SetActPlayer (player);
+  {
+    std::lock_guard<std::mutex> lock (board_mutex);
+    base_board.SetActPlayer (player);
+  }
+  sampler.stats.Reset ();
   Move move = ChooseBestMove ();
   if (move.IsValid ()) {
     CHECK (Play (move));
@@ -48,8 +73,49 @@ Move Engine::Genmove (Player player) {
 }
 
 
+void Engine::Analyze (Player player, double interval,
+                      const std::function <void (const string&)>& report)
+{
+  const uint kPlayoutChunk = 100;   // between clock reads
+  const uint kMaxMoves = 20;
+  const uint kMaxPvLength = 20;
+  {
+    std::lock_guard<std::mutex> lock (board_mutex);
+    base_board.SetActPlayer (player);
+  }
+  pv.Rebuild (*base_node, player);
+
+  double start = WallTime ();
+  double next_report = start + interval;
+  double report_seconds = 0.0;
+  uint report_cnt = 0;
+  uint done = 0;
+  while (!stop_flag->load (std::memory_order_relaxed)) {
+    done += DoNPlayouts (kPlayoutChunk);
+    if (interval <= 0.0) continue;
+    double now = WallTime ();
+    if (now < next_report) continue;
+    report (base_node->AnalyzeInfo (player, kMaxMoves, kMaxPvLength));
+    double after = WallTime ();
+    report_seconds += after - now;
+    report_cnt += 1;
+    next_report = after + interval;
+  }
+  report (base_node->AnalyzeInfo (player, kMaxMoves, kMaxPvLength));
+
+  double seconds = max (WallTime () - start, 1e-9);
+  cerr << "analyze: " << done << " playouts in " << seconds << " s ("
+       << int (done / seconds) << " pps), " << report_cnt << " reports took "
+       << 100.0 * report_seconds / seconds << "% of the time" << endl;
+}
+
+
 bool Engine::Undo () {
-  bool ok = base_board.Undo ();
+  bool ok;
+  {
+    std::lock_guard<std::mutex> lock (board_mutex);
+    ok = base_board.Undo ();
+  }
   if (ok) {
     SyncRoot ();
   }
@@ -59,8 +125,7 @@ bool Engine::Undo () {
 
 void Engine::DoPlayoutMove () {
   PrepareToPlayout ();
-  FastRandom fr;
-  Vertex v = sampler.SampleMove (fr);
+  Vertex v = sampler.SampleMove (random);
   Move move = Move (base_board.ActPlayer (), v);
   CHECK (move.IsValid ());
   CHECK (Play (move));
@@ -72,12 +137,23 @@ const Board& Engine::GetBoard () const {
 }
 
 
+string Engine::BoardAsciiArt () {
+  std::lock_guard<std::mutex> lock (board_mutex);
+  return base_board.ToAsciiArt ();
+}
+
+
+void Engine::SetStopFlag (const std::atomic<bool>* flag) {
+  stop_flag = flag;
+}
+
+
 void Engine::GetInfluence (InfluenceType type, 
                            NatMap <Vertex,double>& influence)
 {
   if (type == SamplerMoveProb) {
     PrepareToPlayout ();
-    sampler.SampleMany (10000, influence);
+    sampler.SampleMany (10000, influence, random);
     return;
   }
 
@@ -98,7 +174,7 @@ void Engine::GetInfluence (InfluenceType type,
     return;
   }
 
-  float log_val = log (base_node->stat.update_count ());
+  float log_val = log (base_node->GetStat ().update_count ());
 
   ForEachNat (Vertex, v) {
     Move m = Move (base_board.ActPlayer (), v);
@@ -110,19 +186,19 @@ void Engine::GetInfluence (InfluenceType type,
           influence [v] = qnan;
           break;
         case MctsN:
-          influence [v] = node->stat.update_count();
+          influence [v] = node->GetStat ().update_count();
           break;
         case MctsMean:
-          influence [v] = node->stat.mean();
+          influence [v] = node->GetStat ().mean();
           break;
         case RaveN:
-          influence [v] = node->rave_stat.update_count();
+          influence [v] = node->GetRaveStat ().update_count();
           break;
         case RaveMean:
-          influence [v] = node->rave_stat.mean();
+          influence [v] = node->GetRaveStat ().mean();
           break;
         case Bias:
-          influence [v] = node->bias;
+          influence [v] = node->GetBias ();
           break;
         case MctsPolicyMix:
           influence [v] = node->SubjectiveRaveValue (base_board.ActPlayer(), log_val);
@@ -182,22 +258,106 @@ std::string Engine::GetStringForVertex (Vertex v) {
 Move Engine::ChooseBestMove () {
   // TODO Garbage collection of old tree here !
   Player player = base_board.ActPlayer ();
-  int playouts = time_control.PlayoutCount (player);
-  DoNPlayouts (playouts);
+  uint playouts = time_control.PlayoutCount (player);
+  pv.Rebuild (*base_node, player);
+
+  // Stop early when the runner-up can not catch up in the playouts
+  // that are left, either by count or before the deadline.
+  const uint period = time_control.early_stop_period;
+  time_control.StartSearch (player, base_board.EmptyVertexCount ());
+  PROFILE_RESET ();
+  uint done = 0;
+  uint saved = 0;
+  {
+    PROFILE_PHASE (Search);
+    while (done < playouts && !time_control.IsTimeUp () &&
+           !stop_flag->load (std::memory_order_relaxed)) {
+      done += DoNPlayouts (period > 0 ? min (period, playouts - done) : playouts - done);
+      if (period == 0 || done >= playouts || time_control.replay_playouts > 0) continue;
+      float remaining = min (float (playouts - done), time_control.RemainingPlayouts ());
+      if (base_node->VisitLead (player) > remaining) {
+        saved = playouts - done;
+        break;
+      }
+    }
+  }
+  time_control.StopSearch (done, saved);
 
   const MctsNode& best_node = base_node->MostExploredChild (player);
+  float best_mean = best_node.SubjectiveMean ();
+
+  // Mean is too optimistic to resign on while the offset helps us.
+  bool offset_helps = komi_offset * player.ToScore () < 0.0;
+  UpdateKomiOffset (player, best_mean);
 
   return
-    best_node.SubjectiveMean() < Param::resign_mean ?
+    best_mean < Param::resign_mean && !offset_helps ?
     Move::Invalid() :
-    Move (player, best_node.v);
+    Move (player, best_node.GetVertex ());
 }
 
 
-void Engine::DoNPlayouts (uint n) {
-  rep (ii, n) {
-    DoOnePlayout (true, true);
+// Dynamic komi: when the best move wins (or loses) almost every
+// playout the tree gets no signal. The offset is moved against the
+// leading side by dynamic_komi_step points, for the next search.
+void Engine::UpdateKomiOffset (Player player, float mean) {
+  if (Param::dynamic_komi_step <= 0.0) return;
+  float step = Param::dynamic_komi_step * player.ToScore ();
+  if (mean > Param::dynamic_komi_high) {
+    komi_offset += step;
+  } else if (mean < Param::dynamic_komi_low) {
+    komi_offset -= step;
+  } else {
+    return;
+  }
+  komi_offset = max (-Param::dynamic_komi_max, min (Param::dynamic_komi_max, komi_offset));
+  cerr << "dynamic komi: mean " << mean << ", offset " << komi_offset << endl;
+}
+
+
+// Returns number of playouts done, less than n if time is up.
+// Leaf playouts over the move limit are tried but not done.
+uint Engine::DoNPlayouts (uint n) {
+  uint done = 0;
+  uint tried = 0;
+  while (tried < n && !time_control.IsTimeUp () &&
+         !stop_flag->load (std::memory_order_relaxed)) {
+    uint k = 1;
+    if (Param::tree_leaf_playouts > 1) {
+      uint batch = min (Param::tree_leaf_playouts, n - tried);
+      k = DoLeafPlayouts (batch);
+      tried += batch;
+    } else {
+      DoOnePlayout (true, true);
+      tried += 1;
+    }
+    done += k;
+    playouts_since_report += k;
+    if (Param::pv_report_period > 0 && playouts_since_report >= Param::pv_report_period) {
+      ReportPv ();
+      playouts_since_report = 0;
+    }
+  }
+  return done;
+}
+
+
+// Cached PV as GoGui live graphics on cerr.
+void Engine::ReportPv () {
+  Gtp::GoguiGfx gfx;
+  rep (ii, pv.Size ()) {
+    gfx.AddVariationMove (pv.Get (ii).GetMove ().ToGtpString ());
+  }
+  if (pv.Size () > 0) {
+    const MctsNode& best = pv.Get (0);
+    ostringstream status;
+    status << "playouts " << base_node->GetStat ().update_count ()
+           << " best " << best.GetVertex ().ToGtpString ()
+           << " visits " << best.GetStat ().update_count ()
+           << " mean " << best.SubjectiveMean ();
+    gfx.SetStatusBar (status.str ());
   }
+  gfx.ReportLive (cerr);
 }
 
 
@@ -207,7 +367,7 @@ void Engine::SyncRoot () {
   Sampler sampler(sync_board, gammas);
   sampler.NewPlayout ();
 
-  base_node = &root;
+  base_node = root;
   const vector<Move>& moves = base_board.Moves ();
   rep (ii, moves.size()) {
     Move m = moves [ii];
@@ -221,7 +381,10 @@ void Engine::SyncRoot () {
 
   EnsureAllLegalChildren (base_node, base_board, sampler);
   RemoveIllegalChildren (base_node, base_board);
-  cerr << endl << base_node->RecToString (100, 6) << endl;
+  pv.Rebuild (*base_node, base_board.ActPlayer ());
+  if (Param::tree_dump) {
+    cerr << endl << base_node->RecToString (100, 6) << endl;
+  }
 }
 
 
@@ -236,19 +399,75 @@ void Engine::DoOnePlayout (bool use_tree, bool update_tree) {
 
     Move m = Move::Invalid ();
     if (!m.IsValid()) m = ChooseMctsMove (&tree_phase);
-    if (!m.IsValid()) m = Move (playout_board.ActPlayer (), sampler.SampleMove (random));
+    if (!m.IsValid()) m = Move (playout_board.ActPlayer (), SampleMove ());
     PlayMove (m);
   }
 
   if (update_tree) {
     double score = Score (tree_phase);
     trace.UpdateTraceRegular (score);
+    pv.Update (trace);
+  }
+}
+
+
+// Leaf-parallel mode: one tree descent, n playouts from the leaf.
+// Tree statistics get a single update with the mean score.
+// Returns number of scored playouts, the ones over the move limit are
+// dropped.
+uint Engine::DoLeafPlayouts (uint n) {
+  bool tree_phase = true;
+  PrepareToPlayout();
+
+  while (tree_phase) {
+    if (playout_board.BothPlayerPass()) break;
+    if (playout_board.MoveCount() >= 3*Board::kArea) return 0;
+    Move m = ChooseMctsMove (&tree_phase);
+    if (!m.IsValid()) break;
+    PlayMove (m);
+  }
+
+  leaf_board.Load (playout_board);
+  const uint leaf_move_cnt = playout_moves.size ();
+  const uint leaf_trace_cnt = trace.MoveCount ();
+
+  double score_sum = 0.0;
+  uint score_cnt = 0;
+
+  rep (ii, n) {
+    if (ii > 0) {
+      playout_board.Load (leaf_board);
+      sampler.NewPlayout ();
+      playout_moves.resize (leaf_move_cnt);
+      trace.TruncateMoves (leaf_trace_cnt);
+    }
+
+    while (!playout_board.BothPlayerPass() &&
+           playout_board.MoveCount() < 3*Board::kArea) {
+      PlayMove (Move (playout_board.ActPlayer (), SampleMove ()));
+    }
+    if (!playout_board.BothPlayerPass()) continue;
+
+    double score = Score (tree_phase);
+    if (Param::tree_rave_update) trace.UpdateTraceRave (score);
+    score_sum += score;
+    score_cnt += 1;
   }
+
+  if (score_cnt > 0) {
+    trace.UpdateTraceBatch (score_sum / score_cnt, score_cnt);
+    pv.Update (trace);
+  }
+  return score_cnt;
 }
 
 
 void Engine::PrepareToPlayout () {
+  PROFILE_PHASE (Prepare);
   playout_board.Load (base_board);
+  if (komi_offset != 0.0) {
+    playout_board.SetKomi (base_board.Komi () + komi_offset);
+  }
   playout_moves.clear();
   sampler.NewPlayout ();
 
@@ -257,52 +476,111 @@ void Engine::PrepareToPlayout () {
 }
 
 Move Engine::ChooseMctsMove (bool* tree_phase) {
+  PROFILE_PHASE (TreeMove);
   Player pl = playout_board.ActPlayer();
 
   if (!*tree_phase) {
     return Move::Invalid();
   }
 
-  if (!playout_node->has_all_legal_children [pl]) {
+  if (playout_node->children [pl].Size () == 0) {
     if (!playout_node->ReadyToExpand ()) {
       *tree_phase = false;
       return Move::Invalid();
     }
     ASSERT (pl == playout_node->player.Other());
+  }
+
+  if (Param::tree_widening_base > 0.0) {
+    WidenChildren (playout_node, playout_board, sampler);
+  } else {
     EnsureAllLegalChildren (playout_node, playout_board, sampler);
   }
 
   MctsNode& uct_child = playout_node->BestRaveChild (pl);
   trace.NewNode (uct_child);
   playout_node = &uct_child;
-  ASSERT (uct_child.v != Vertex::Any());
-  return Move (pl, uct_child.v);
+  ASSERT (uct_child.GetVertex () != Vertex::Any());
+  return Move (pl, uct_child.GetVertex ());
 }
 
 void Engine::EnsureAllLegalChildren (MctsNode* node, const Board& board, const Sampler& sampler) {
   Player pl = board.ActPlayer ();
-  if (node->has_all_legal_children [pl]) return;
+  if (node->HasAllLegalChildren (pl)) return;
+
+  // Node might be widened by WidenChildren, the rest is listed already.
+  MctsChildren& children = node->children [pl];
+  if (children.IsListed ()) {
+    children.SetComplete ();
+    return;
+  }
+  ASSERT (children.Size () == 0);
+
   empty_v_for_each_and_pass (&board, v, {
       // superko nodes have to be removed from the tree later
       if (board.IsLegal (pl, v)) {
       double bias = sampler.Probability (pl, v);
-      node->AddChild (MctsNode(pl, v, bias));
+      node->AddChild (pl, v, bias);
       }
       });
-  node->has_all_legal_children [pl] = true;
+  children.SetComplete ();
+}
+
+
+namespace {
+  struct WideningCandidate {
+    float bias;
+    Vertex v;
+  };
+
+  bool HigherBias (const WideningCandidate& a, const WideningCandidate& b) {
+    return a.bias > b.bias;
+  }
+}
+
+// Progressive widening: on the first expansion all legal moves are
+// listed once, in descending bias order, and become children as
+// MctsNode::Widen unlocks them.
+void Engine::WidenChildren (MctsNode* node, const Board& board, const Sampler& sampler) {
+  Player pl = board.ActPlayer ();
+  MctsChildren& children = node->children [pl];
+  if (children.IsComplete ()) return;
+
+  if (!children.IsListed ()) {
+    ASSERT (children.ListedSize () == 0);
+    WideningCandidate candidates [Board::kArea + 1];
+    uint candidate_cnt = 0;
+    empty_v_for_each_and_pass (&board, v, {
+        if (board.IsLegal (pl, v)) {
+          candidates [candidate_cnt].bias = sampler.Probability (pl, v);
+          candidates [candidate_cnt].v = v;
+          candidate_cnt += 1;
+        }
+        });
+
+    sort (candidates, candidates + candidate_cnt, HigherBias);
+    rep (ii, candidate_cnt) {
+      children.AddLocked (candidates [ii].v, candidates [ii].bias);
+      children.ResetStats (ii, pl);
+    }
+    children.SetListed ();
+  }
+
+  node->Widen (pl);
 }
 
 
 void Engine::RemoveIllegalChildren (MctsNode* node, const Board& board) {
   Player pl = board.ActPlayer ();
-  ASSERT (node->has_all_legal_children [pl]);
+  ASSERT (node->HasAllLegalChildren (pl));
 
-  MctsNode::ChildrenList::iterator child = node->children.begin();
-  while (child != node->children.end()) {
-    if (child->player == pl && !board.IsReallyLegal (Move (pl, child->v))) {
-      node->children.erase (child++);
+  MctsChildren& children = node->children [pl];
+  uint ii = 0;
+  while (ii < children.Size ()) {
+    if (!board.IsReallyLegal (Move (pl, children.GetVertex (ii)))) {
+      children.Remove (ii);
     } else {
-      ++child;
+      ++ii;
     }
   }
 }
@@ -310,22 +588,46 @@ void Engine::RemoveIllegalChildren (MctsNode* node, const Board& board) {
 
 void Engine::PlayMove (Move m) {
   ASSERT (playout_board.IsLegal (m));
-  playout_board.PlayLegal (m);
+  {
+    PROFILE_PHASE (PlayLegal);
+    playout_board.PlayLegal (m);
+  }
 
   trace.NewMove (m);
-  sampler.MovePlayed ();
+  {
+    PROFILE_PHASE (SamplerUpdate);
+    sampler.MovePlayed ();
+  }
 
   playout_moves.push_back (m);
 }
 
 
+Vertex Engine::SampleMove () {
+  PROFILE_PHASE (Sample);
+  return sampler.SampleMove (random);
+}
+
+
 vector<Move> Engine::LastPlayout () {
   return playout_moves;
 }
 
 
 double Engine::Score (bool tree_phase) {
+  PROFILE_PHASE (Score);
   // TODO game replay i update wszystkich modeli
+  if (Param::score_weight > 0.0) {
+    // Score-aware backup: winner blended with a squashed score margin.
+    // Stat keeps the mean and E(X^2) of these, so Stat::Mix weighs the
+    // RAVE mix by their actual spread.
+    int sc = tree_phase ? playout_board.TrompTaylorScore () : playout_board.PlayoutScore ();
+    double winner = Player::WinnerOfBoardScore (sc).ToScore ();
+    return
+      (1.0 - Param::score_weight) * winner +
+      Param::score_weight * tanh (sc / Param::score_scale);
+  }
+
   double score;
   if (tree_phase) {
     score = playout_board.TrompTaylorWinner().ToScore();
@@ -5,11 +5,15 @@
 #ifndef ENGINE_H_
 #define ENGINE_H_
 
+#include <atomic>
+#include <mutex>
+
 #include "to_string.hpp"
 #include "gtp_gogui.hpp"
 #include "ego.hpp"
 #include "time_control.hpp"
 #include "mcts_tree.hpp"
+#include "profiler.hpp"
 
 class Engine {
 public:
@@ -19,21 +23,36 @@ public:
   void SetKomi (float komi);
   bool Play (Move move);
   Move Genmove (Player player);
+
+  // Searches for player until the stop flag is raised, report gets the
+  // lz-analyze info line every interval seconds (0 - only at the end).
+  void Analyze (Player player, double interval,
+                const std::function <void (const string&)>& report);
   bool Undo ();
 
   void DoPlayoutMove ();
 
   const Board& GetBoard () const;
 
+  // Safe during a search running in another thread.
+  string BoardAsciiArt ();
+
+  // Searches stop early when the flag is raised.
+  void SetStopFlag (const std::atomic<bool>* flag);
+
   // Playout functions
   Move ChooseBestMove ();
-  void DoNPlayouts (uint n);
+  uint DoNPlayouts (uint n);
   void SyncRoot ();
   void PrepareToPlayout ();
   void DoOnePlayout (bool use_tree, bool update_tree);
+  uint DoLeafPlayouts (uint n);
   Move ChooseMctsMove (bool* tree_phase);
   void PlayMove (Move m);
+  Vertex SampleMove ();
   double Score (bool tree_phase);
+  void UpdateKomiOffset (Player player, float mean);
+  void ReportPv ();
 
   enum InfluenceType {
     NoInfluence,
@@ -56,6 +75,7 @@ public:
   vector<Move> LastPlayout ();
 
   void EnsureAllLegalChildren (MctsNode* node, const Board& board, const Sampler& sampler);
+  void WidenChildren (MctsNode* node, const Board& board, const Sampler& sampler);
   void RemoveIllegalChildren (MctsNode* node, const Board& board);
 
 private:
@@ -66,19 +86,31 @@ private:
 
   FastRandom random;
 
-  MctsNode root;
+  MctsChildren root_stats; // Statistics of the root, it is its only entry.
+  MctsNode* root;
   Sampler sampler;
 
   Board base_board;
   MctsNode* base_node;
+
+  // Added to the game komi in playouts, positive favours white.
+  float komi_offset;
   
   Board playout_board;
   MctsNode* playout_node;
+  Board leaf_board;
 
   vector<Move> playout_moves;
   MctsTrace trace;
 
+  PvCache pv;
+  uint playouts_since_report;
+
+  const std::atomic<bool>* stop_flag;
+  std::mutex board_mutex;   // base_board changes vs. BoardAsciiArt
+
   friend class MctsGtp;
+  friend class ReplayLog;
 };
 
 #endif /* ENGINE_H_ */
@@ -12,6 +12,7 @@ public:
   {
     RegisterCommands ();
     RegisterParams ();
+    engine.SetStopFlag (gtp.InterruptFlag ());
   }
 
 private:
@@ -23,10 +24,21 @@ private:
     gtp.Register ("play",         this, &MctsGtp::Cplay);
     gtp.Register ("undo",         this, &MctsGtp::Cundo);
     gtp.Register ("genmove",      this, &MctsGtp::Cgenmove);
+    gtp.Register ("analyze",      this, &MctsGtp::Canalyze);
+    gtp.SetStreaming ("analyze");
     gtp.Register ("showboard",    this, &MctsGtp::Cshowboard);
+    gtp.SetImmediate ("showboard");
     gtp.Register ("gui",          this, &MctsGtp::Cgui);
 
     gtp.Register ("LoadGammas",   this, &MctsGtp::CLoadGammas);
+    gtp.Register ("ConvertGammas", this, &MctsGtp::CConvertGammas);
+    gtp.Register ("sampler_benchmark", this, &MctsGtp::CSamplerBenchmark);
+    gtp.Register ("sampler_stats", this, &MctsGtp::CSamplerStats);
+    gtp.Register ("selection_benchmark", this, &MctsGtp::CSelectionBenchmark);
+    gtp.Register ("DoLeafPlayouts", this, &MctsGtp::CDoLeafPlayouts);
+    gtp.Register ("tree_json",    this, &MctsGtp::CTreeJson);
+    gtp.Register ("pv",           this, &MctsGtp::CPv);
+    gtp.Register ("profile",      this, &MctsGtp::CProfile);
 
     gtp.RegisterGfx ("DoPlayouts",      "1", this, &MctsGtp::CDoPlayouts);
     gtp.RegisterGfx ("DoPlayouts",     "10", this, &MctsGtp::CDoPlayouts);
@@ -53,10 +65,12 @@ private:
     string tree  = "param.tree";
     string other = "param.other";
     string set = "set";
+    string score = "param.score";
 
     gtp.RegisterParam (other, "genmove_playouts",     &Param::genmove_playouts);
     gtp.RegisterParam (other, "local_use",            &Param::use_local);
-    gtp.RegisterParam (other, "seed",                 &engine.random.seed);
+    gtp.RegisterParam (other, "seed",
+                       Gtp::Repl::Callback (std::bind (&MctsGtp::CSeed, this, std::placeholders::_1)));
 
     gtp.RegisterParam (tree, "use",             &Param::tree_use);
     gtp.RegisterParam (tree, "max_moves",       &Param::tree_max_moves);
@@ -66,14 +80,86 @@ private:
     gtp.RegisterParam (tree, "stat_bias",       &Param::tree_stat_bias);
     gtp.RegisterParam (tree, "rave_bias",       &Param::tree_rave_bias);
     gtp.RegisterParam (tree, "rave_update_fraction", &Param::tree_rave_update_fraction);
+    gtp.RegisterParam (tree, "rave_update_decay", &Param::tree_rave_update_decay);
+    gtp.RegisterParam (tree, "widening_base",   &Param::tree_widening_base);
+    gtp.RegisterParam (tree, "widening_start",  &Param::tree_widening_start);
+    gtp.RegisterParam (tree, "widening_factor", &Param::tree_widening_factor);
+    gtp.RegisterParam (tree, "leaf_playouts",   &Param::tree_leaf_playouts);
+    gtp.RegisterParam (tree, "dump",            &Param::tree_dump);
+    gtp.RegisterParam (other, "pv_report_period", &Param::pv_report_period);
     gtp.RegisterParam (tree, "progressive_bias",&Param::tree_progressive_bias);
 
+    gtp.RegisterParam (score, "dynamic_komi_step", &Param::dynamic_komi_step);
+    gtp.RegisterParam (score, "dynamic_komi_high", &Param::dynamic_komi_high);
+    gtp.RegisterParam (score, "dynamic_komi_low",  &Param::dynamic_komi_low);
+    gtp.RegisterParam (score, "dynamic_komi_max",  &Param::dynamic_komi_max);
+    gtp.RegisterParam (score, "komi_offset",       &engine.komi_offset);
+    gtp.RegisterParam (score, "weight",            &Param::score_weight);
+    gtp.RegisterParam (score, "scale",             &Param::score_scale);
+
     gtp.RegisterParam (set, "progressive_bias",       &Param::tree_progressive_bias);
     gtp.RegisterParam (set, "progressive_bias_prior", &Param::tree_progressive_bias_prior);
     gtp.RegisterParam (set, "explore_coeff",          &Param::tree_explore_coeff);
 
-    gtp.RegisterParam (set, "proxy_1_bonus", &engine.sampler.proximity_bonus[0]);
-    gtp.RegisterParam (set, "proxy_2_bonus", &engine.sampler.proximity_bonus[1]);
+    rep (ii, ProximityTable::kClassCount) {
+      gtp.RegisterParam (set, "proxy_" + ToString (ii+1) + "_bonus",
+                         LocalParam (&engine.sampler.proximity_bonus[ii]));
+    }
+    gtp.RegisterParam (set, "local_radius", LocalParam (&engine.sampler.local_radius));
+    gtp.RegisterParam (set, "policy_temperature",
+                       Gtp::Repl::Callback (std::bind (&MctsGtp::CPolicyTemperature, this, std::placeholders::_1)));
+    gtp.RegisterParam (set, "policy_prune",
+                       Gtp::Repl::Callback (std::bind (&MctsGtp::CPolicyPrune, this, std::placeholders::_1)));
+    gtp.RegisterParam (set, "alias_sampling", &engine.sampler.use_alias);
+    gtp.RegisterParam (set, "alias_rebuild_fraction", &engine.sampler.alias_rebuild_fraction);
+  }
+
+  // Param of the local gammas, the sampler drops its cached split when
+  // it is set.
+  template <typename T>
+  Gtp::Repl::Callback LocalParam (T* param) {
+    return Gtp::Repl::Callback (std::bind (&MctsGtp::CLocalParam, this,
+                                           Gtp::GetSetCallback (param),
+                                           std::placeholders::_1));
+  }
+
+  void CLocalParam (Gtp::Repl::Callback get_set, Gtp::Io& io) {
+    get_set (io);
+    engine.sampler.InvalidateLocalGammas ();
+  }
+
+  // The policy table is built by Gammas::SetPolicy, not on use.
+  void CPolicyTemperature (Gtp::Io& io) {
+    if (io.IsEmpty ()) {
+      io.out << engine.gammas.PolicyTemperature ();
+      return;
+    }
+    double temperature = io.Read<double> ();
+    io.CheckEmpty ();
+    engine.gammas.SetPolicy (temperature, engine.gammas.PolicyPruneFraction ());
+    engine.sampler.RefreshPolicy ();
+  }
+
+  void CPolicyPrune (Gtp::Io& io) {
+    if (io.IsEmpty ()) {
+      io.out << engine.gammas.PolicyPruneFraction ();
+      return;
+    }
+    double prune_fraction = io.Read<double> ();
+    io.CheckEmpty ();
+    engine.gammas.SetPolicy (engine.gammas.PolicyTemperature (), prune_fraction);
+    engine.sampler.RefreshPolicy ();
+  }
+
+  // Generator state is not a single number, setting the seed restarts it.
+  void CSeed (Gtp::Io& io) {
+    if (io.IsEmpty ()) {
+      io.out << engine.random.GetSeed ();
+      return;
+    }
+    uint seed = io.Read<uint> ();
+    io.CheckEmpty ();
+    engine.random.SetSeed (seed);
   }
 
   void Cclear_board (Gtp::Io& io) {
@@ -88,6 +174,26 @@ private:
     io.out << (m.IsValid() ? m.GetVertex().ToGtpString() : "resign");
   }
 
+  // analyze [color] interval_cs
+  // Searches until the next command, sending lz-analyze info lines.
+  void Canalyze (Gtp::Io& io) {
+    Player player = engine.GetBoard ().ActPlayer ();
+    io.in >> ws;
+    if (!isdigit (io.in.peek ())) player = io.Read<Player> ();
+    int interval_cs = io.Read<int> ();
+    io.CheckEmpty ();
+    if (interval_cs < 0) {
+      io.SetError ("negative interval");
+      return;
+    }
+    if (!io.CanStream ()) {
+      io.SetError ("analyze needs the asynchronous GTP loop");
+      return;
+    }
+    engine.Analyze (player, interval_cs / 100.0,
+                    std::bind (&Gtp::Io::StreamLine, &io, std::placeholders::_1));
+  }
+
   void Cboardsize (Gtp::Io& io) {
     int new_board_size = io.Read<int> ();
     io.CheckEmpty ();
@@ -123,7 +229,7 @@ private:
 
   void Cshowboard (Gtp::Io& io) {
     io.CheckEmpty ();
-    io.out << engine.GetBoard().ToAsciiArt ();
+    io.out << engine.BoardAsciiArt ();
   }
 
   void CDoPlayouts (Gtp::Io& io) {
@@ -132,6 +238,23 @@ private:
     engine.DoNPlayouts (n);
   }
 
+  // Like DoPlayouts with given playouts per tree leaf, reports speed.
+  void CDoLeafPlayouts (Gtp::Io& io) {
+    uint n = io.Read <uint> (Param::genmove_playouts);
+    uint leaf_playouts = io.Read <uint> (Param::tree_leaf_playouts);
+    io.CheckEmpty();
+
+    uint saved = Param::tree_leaf_playouts;
+    Param::tree_leaf_playouts = max (1u, leaf_playouts);
+    float start = ProcessUserTime ();
+    uint done = engine.DoNPlayouts (n);
+    float seconds = ProcessUserTime () - start;
+    Param::tree_leaf_playouts = saved;
+
+    io.out << done << " playouts, " << leaf_playouts << " per leaf, "
+           << seconds << " s, " << done / max (seconds, 0.001f) << " playouts/s";
+  }
+
   void CShowLastPlayout (Gtp::Io& io) {
     uint move_count = io.Read<uint> ();
     io.CheckEmpty ();
@@ -189,9 +312,48 @@ private:
   }
 
 
+  // tree_json [max_children], see MctsNode::ToJson.
+  void CTreeJson (Gtp::Io& io) {
+    uint max_children = io.Read <uint> (0);
+    io.CheckEmpty ();
+    io.out << engine.base_node->ToJson (engine.base_board.ActPlayer (), max_children);
+  }
+
+  // Cached principal variation, as a GoGui variation.
+  void CPv (Gtp::Io& io) {
+    io.CheckEmpty ();
+    Gtp::GoguiGfx gfx;
+    rep (ii, engine.pv.Size ()) {
+      gfx.AddVariationMove (engine.pv.Get (ii).GetMove ().ToGtpString ());
+    }
+    gfx.Report (io);
+  }
+
+  // Phases of the last genmove search, see PhaseProfiler.
+  void CProfile (Gtp::Io& io) {
+    io.CheckEmpty ();
+    if (!PhaseProfiler::Enabled ()) {
+      io.SetError ("profiler disabled, build with -DEGO_PROFILE=ON");
+      return;
+    }
+    io.out << endl << PhaseProfiler::Get ().ToString ();
+  }
+
   void CLoadGammas (Gtp::Io& io) {
     string file_name = io.Read<string> ();
     io.CheckEmpty ();
+    LoadGammas (file_name, io);
+    // The sampler may point into the unmapped table.
+    engine.sampler.RefreshPolicy ();
+  }
+
+  void LoadGammas (const string& file_name, Gtp::Io& io) {
+    if (Gammas::IsBinaryFile (file_name)) {
+      if (!engine.gammas.ReadBinary (file_name)) {
+        io.SetError ("Bad binary gamma file: " + file_name);
+      }
+      return;
+    }
     ifstream in;
     in.open (file_name.c_str(), ifstream::in);
     if (!in.good()) {
@@ -205,6 +367,51 @@ private:
     in.close();
   }
 
+  void CSamplerBenchmark (Gtp::Io& io) {
+    uint n = io.Read<uint> (10000);
+    io.CheckEmpty ();
+    io.out << Benchmark::SamplerRun (n, engine.gammas);
+  }
+
+  // Cost of MCTS child selection for 9x9 and 19x19 sized nodes.
+  void CSelectionBenchmark (Gtp::Io& io) {
+    uint rounds = io.Read<uint> (100000);
+    io.CheckEmpty ();
+    io.out << endl << SelectionBenchmark (81 + 1, rounds)
+           << endl << SelectionBenchmark (361 + 1, rounds);
+  }
+
+  // Statistics of playout policy since the last genmove.
+  void CSamplerStats (Gtp::Io& io) {
+    io.CheckEmpty ();
+    if (!kSamplerStats) {
+      io.SetError ("sampler stats disabled, build with -DEGO_SAMPLER_STATS=ON");
+      return;
+    }
+    io.out << engine.sampler.stats.ToString ();
+  }
+
+  // Converts text gamma file to binary format (see Gammas::ReadBinary).
+  void CConvertGammas (Gtp::Io& io) {
+    string text_file_name = io.Read<string> ();
+    string binary_file_name = io.Read<string> ();
+    io.CheckEmpty ();
+    ifstream in (text_file_name.c_str());
+    if (!in.good()) {
+      io.SetError ("Can't open a file: " + text_file_name);
+      return;
+    }
+    Gammas gammas;
+    if (!gammas.Read (in)) {
+      io.SetError ("File in a bad format.");
+      return;
+    }
+    if (!gammas.WriteBinary (binary_file_name)) {
+      io.SetError ("Can't write a file: " + binary_file_name);
+      return;
+    }
+  }
+
   void Cgui (Gtp::Io& io) {
     io.CheckEmpty ();
     //RunGui (engine);
@@ -1,100 +1,342 @@
-#include <list>
 #include <algorithm>
+#include <cstdlib>
+#include <cstring>
 #include "mcts_tree.hpp"
 #include "gtp_gogui.hpp"
+#include "profiler.hpp"
 
 extern Gtp::ReplWithGogui gtp;
 
-MctsNode::MctsNode (Player player, Vertex v, double bias)
-: player(player), v(v), has_all_legal_children (false), bias(bias)
+MctsChildren::MctsChildren ()
+: data (NULL), size (0), widening_visits (0.0), capacity (0), listed (0), complete (false)
 {
+}
+
+MctsChildren::~MctsChildren () {
+  Clear ();
+}
+
+void MctsChildren::Clear () {
+  rep (ii, listed) delete Nodes () [ii];
+  free (data);
+  data = NULL;
+  size = 0;
+  capacity = 0;
+  listed = 0;
+  complete = false;
+  widening_visits = 0.0;
+}
+
+void MctsChildren::Grow () {
+  uint new_capacity = max (8u, 2u * capacity);
+  CHECK (new_capacity <= 0xffff);
+  char* new_data = static_cast <char*> (malloc (new_capacity * kEntrySize));
+  CHECK (new_data != NULL);
+
+  MctsChildren grown;
+  grown.data = new_data;
+  grown.capacity = new_capacity;
+  memcpy (grown.Nodes (),         Nodes (),         listed * sizeof (MctsNode*));
+  memcpy (grown.Stats (),         Stats (),         listed * sizeof (Stat));
+  memcpy (grown.RaveStats (),     RaveStats (),     listed * sizeof (Stat));
+  memcpy (grown.InvSqrtCounts (), InvSqrtCounts (), listed * sizeof (float));
+  memcpy (grown.Biases (),        Biases (),        listed * sizeof (float));
+  memcpy (grown.Vertices (),      Vertices (),      listed * sizeof (Vertex));
+
+  free (data);
+  data = new_data;
+  capacity = new_capacity;
+  grown.data = NULL;
+}
+
+void MctsChildren::Add (Vertex v, float bias) {
+  ASSERT (size == listed);
+  AddLocked (v, bias);
+  size += 1;
+}
+
+void MctsChildren::AddLocked (Vertex v, float bias) {
   ASSERT2 (!qisnan (bias), WW(bias));
   ASSERT2 (bias >= 0.0, WW(bias));
   ASSERT2 (bias <= 1.0, WW(bias));
-  Reset ();
+  if (listed == capacity) Grow ();
+  Nodes () [listed] = NULL;
+  Biases () [listed] = bias;
+  Vertices () [listed] = v;
+  listed += 1;
 }
 
-Move MctsNode::GetMove () const {
-  return Move(player, v);
+void MctsChildren::UnlockNext () {
+  ASSERT (size < listed);
+  size += 1;
 }
 
-void MctsNode::AddChild (const MctsNode& node) {
-  children.push_front (node);
+void MctsChildren::CopyEntry (uint from, uint to) {
+  Nodes ()         [to] = Nodes ()         [from];
+  Stats ()         [to] = Stats ()         [from];
+  RaveStats ()     [to] = RaveStats ()     [from];
+  InvSqrtCounts () [to] = InvSqrtCounts () [from];
+  Biases ()        [to] = Biases ()        [from];
+  Vertices ()      [to] = Vertices ()      [from];
 }
 
-// TODO better implementation of child removation.
-void MctsNode::RemoveChild (MctsNode* child_ptr) {
-  ChildrenList::iterator child = children.begin();
-  while (true) {
-    ASSERT (child != children.end());
-    if (&*child == child_ptr) {
-      children.erase(child);
-      return;
-    }
-    child++;
-  }
+void MctsChildren::Remove (uint ii) {
+  ASSERT (ii < size);
+  delete Nodes () [ii];
+  size -= 1;
+  CopyEntry (size, ii);
+  if (Nodes () [ii] != NULL) Nodes () [ii]->index = ii;
+  // Locked candidates keep their order.
+  listed -= 1;
+  for (uint jj = size; jj < listed; jj++) CopyEntry (jj + 1, jj);
 }
 
-bool MctsNode::ReadyToExpand () const {
-  return stat.update_count() > 
-    Param::prior_update_count + Param::mature_update_count;
+void MctsChildren::ResetStats (uint ii, Player pl) {
+  float prior_mean = pl.SubjectiveScore (Param::prior_mean);
+  Stats () [ii].reset (Param::prior_update_count, prior_mean);
+  RaveStats () [ii].reset (Param::prior_update_count, prior_mean);
+  InvSqrtCounts () [ii] = VisitTable::Get ().InvSqrt (Stats () [ii].update_count ());
 }
 
-MctsNode* MctsNode::FindChild (Move m) {
-  // TODO make invariant about haveChildren and has_all_legal_children
-  Player pl = m.GetPlayer();
-  Vertex v  = m.GetVertex();
-  ASSERT (has_all_legal_children [pl]);
-  for (ChildrenList::iterator child = children.begin();
-       child != children.end();
-       ++child)
-  {
-    if (child->player == pl && child->v == v) {
-      return &(*child);
+void MctsChildren::UpdateStat (uint ii, float score, float weight) {
+  Stats () [ii].update (score, weight);
+  InvSqrtCounts () [ii] = VisitTable::Get ().InvSqrt (Stats () [ii].update_count ());
+}
+
+void MctsChildren::UpdateRaveStat (uint ii, float score, float weight) {
+  RaveStats () [ii].update (score, weight);
+}
+
+MctsNode& MctsChildren::GetNode (Player pl, uint ii) {
+  ASSERT (ii < size);
+  MctsNode*& node = Nodes () [ii];
+  if (node == NULL) node = new MctsNode (this, ii, pl);
+  return *node;
+}
+
+uint MctsChildren::Find (Vertex v) const {
+  const Vertex* vertices = Vertices ();
+  rep (ii, size) {
+    if (vertices [ii] == v) return ii;
+  }
+  return size;
+}
+
+// Same formula as SlowUrgency. Urgencies are computed in chunks into
+// a local array so that the arithmetic loop has no branches and vectorizes.
+uint MctsChildren::BestRave (Player pl, float log_val) const {
+  const uint kChunk = 64;
+  float urgency [kChunk];
+
+  const Stat* stats = Stats ();
+  const Stat* rave_stats = RaveStats ();
+  const float* inv_sqrt_counts = InvSqrtCounts ();
+  const float* biases = Biases ();
+
+  const bool  rave_use = Param::tree_rave_use;
+  const float sign     = pl.SubjectiveScore (1.0);
+  const float b1       = Param::tree_stat_bias;
+  const float b2       = Param::tree_rave_bias;
+  const float explore  = Param::tree_explore_coeff * sqrt (log_val);
+  const float pb       = Param::tree_progressive_bias;
+  const float pb_prior = Param::tree_progressive_bias_prior;
+
+  uint best = size;
+  float best_urgency = - numeric_limits <float>::infinity ();
+
+  for (uint begin = 0; begin < size; begin += kChunk) {
+    const uint end = min (size, begin + kChunk);
+
+    for (uint ii = begin; ii < end; ii++) {
+      float n1 = stats [ii].update_count ();
+      float m1 = stats [ii].mean ();
+      float n2 = rave_stats [ii].update_count ();
+      float m2 = rave_stats [ii].mean ();
+      float inv_sqrt_n1 = inv_sqrt_counts [ii];
+
+      // Stat::Mix, with the variances clamped the same way.
+      float v1 = stats [ii].square_mean () - m1 * m1;
+      float v2 = rave_stats [ii].square_mean () - m2 * m2;
+      float y1 = (v1 > 0.0f ? v1 : 0.0f) + b1 * n1;
+      float y2 = (v2 > 0.0f ? v2 : 0.0f) + b2 * n2;
+      float t1 = y2 * n1;
+      float t2 = y1 * n2;
+      float mix = (t1*m1 + t2*m2) / (t1 + t2);
+
+      urgency [ii - begin] =
+        sign * (rave_use ? mix : m1)
+        + explore * inv_sqrt_n1
+        + pb * biases [ii] / max (1.0f, n1 + pb_prior);
+    }
+
+    float chunk_max = - numeric_limits <float>::infinity ();
+    for (uint ii = begin; ii < end; ii++) {
+      chunk_max = urgency [ii - begin] > chunk_max ? urgency [ii - begin] : chunk_max;
+    }
+    if (chunk_max >= best_urgency) {
+      uint ii = end - 1;
+      while (ii > begin && urgency [ii - begin] != chunk_max) ii--;
+      best_urgency = chunk_max;
+      best = ii;
     }
   }
 
-  return NULL; // no child
+  ASSERT (best < size);
+  ASSERT (fabs (best_urgency - SlowUrgency (best, pl, log_val)) < 0.0001);
+  return best;
 }
 
-string MctsNode::ToString() const {
+float MctsChildren::SlowUrgency (uint ii, Player pl, float log_val) const {
+  const Stat& stat = GetStat (ii);
+  float value;
+
+  if (Param::tree_rave_use) {
+    value = Stat::Mix (stat,             Param::tree_stat_bias,
+                       GetRaveStat (ii), Param::tree_rave_bias);
+  } else {
+    value = stat.mean ();
+  }
+
+  return
+    pl.SubjectiveScore (value)
+    + Param::tree_explore_coeff * sqrt (log_val / stat.update_count())
+    + Param::tree_progressive_bias * GetBias (ii)
+    / max (1.0f, (stat.update_count () + Param::tree_progressive_bias_prior));
+  // TODO other equation for PB
+}
+
+string MctsChildren::ToString (Player pl, uint ii) const {
   stringstream s;
-  s << player.ToGtpString() << " " 
-    << v.ToGtpString() << " " 
-    << stat.to_string() << " "
-    << rave_stat.to_string() << " + "
-    << bias << " -> "
-    << Stat::Mix (stat,      Param::tree_stat_bias,
-        rave_stat, Param::tree_rave_bias)
-    // << " - ("  << stat.precision (Param::mcts_bias) << " : "
-    // << stat.precision (Param::rave_bias) << ")"
-    // << Stat::SlowMix (stat,
-    //                   Param::mcts_bias,
-    //                   rave_stat,
-    //                   Param::rave_bias)
+  s << pl.ToGtpString() << " " 
+    << GetVertex (ii).ToGtpString() << " " 
+    << GetStat (ii).to_string() << " "
+    << GetRaveStat (ii).to_string() << " + "
+    << GetBias (ii) << " -> "
+    << Stat::Mix (GetStat (ii),     Param::tree_stat_bias,
+                  GetRaveStat (ii), Param::tree_rave_bias)
     ;
 
   return s.str();
 }
 
-string MctsNode::GuiString() const {
+string MctsChildren::GuiString (Player pl, uint ii) const {
   stringstream s;
-  s << player.ToGtpString() << " " 
-    << v.ToGtpString() << endl
-    << "MCTS: " << stat.to_string() << endl
-    << "RAVE: " << rave_stat.to_string() << endl
-    << "Bias: " << bias << endl
+  s << pl.ToGtpString() << " " 
+    << GetVertex (ii).ToGtpString() << endl
+    << "MCTS: " << GetStat (ii).to_string() << endl
+    << "RAVE: " << GetRaveStat (ii).to_string() << endl
+    << "Bias: " << GetBias (ii) << endl
     << "Mix:  "
-    << Stat::Mix (stat,      Param::tree_stat_bias,
-                  rave_stat, Param::tree_rave_bias) << endl
+    << Stat::Mix (GetStat (ii),     Param::tree_stat_bias,
+                  GetRaveStat (ii), Param::tree_rave_bias) << endl
     ;
 
   return s.str();
 }
 
+// -----------------------------------------------------------------------------
+
+MctsNode::MctsNode (MctsChildren* parent, uint index, Player player)
+: parent (parent), index (index), player (player)
+{
+}
+
+Move MctsNode::GetMove () const {
+  return Move(player, GetVertex ());
+}
+
+Vertex MctsNode::GetVertex () const {
+  return parent->GetVertex (index);
+}
+
+float MctsNode::GetBias () const {
+  return parent->GetBias (index);
+}
+
+const Stat& MctsNode::GetStat () const {
+  return parent->GetStat (index);
+}
+
+const Stat& MctsNode::GetRaveStat () const {
+  return parent->GetRaveStat (index);
+}
+
+void MctsNode::UpdateStat (float score, float weight) {
+  parent->UpdateStat (index, score, weight);
+}
+
+void MctsNode::AddChild (Player pl, Vertex v, float bias) {
+  children [pl].Add (v, bias);
+  children [pl].ResetStats (children [pl].Size () - 1, pl);
+}
+
+void MctsNode::RemoveChild (Player pl, Vertex v) {
+  uint ii = children [pl].Find (v);
+  ASSERT (ii < children [pl].Size ());
+  children [pl].Remove (ii);
+}
+
+bool MctsNode::ReadyToExpand () const {
+  return GetStat ().update_count() > 
+    Param::prior_update_count + Param::mature_update_count;
+}
+
+bool MctsNode::HasAllLegalChildren (Player pl) const {
+  return children [pl].IsComplete ();
+}
+
+// widening_base children (at least one) after expansion, one more at
+// widening_start visits and another one each time visits grow
+// widening_factor times. The visits of the next step are stored, so a
+// tree step only compares. The params are settable over GTP, they are
+// clamped to where the steps grow.
+void MctsNode::Widen (Player pl) {
+  MctsChildren& ch = children [pl];
+  if (ch.Size () == 0) {
+    uint count = max (1u, uint (max (Param::tree_widening_base, 0.0f)));
+    while (ch.Size () < min (count, ch.ListedSize ())) ch.UnlockNext ();
+    ch.SetWideningVisits (max (Param::tree_widening_start, 1.0f));
+  }
+  float visits = GetStat ().update_count ();
+  while (visits >= ch.WideningVisits () && ch.Size () < ch.ListedSize ()) {
+    ch.UnlockNext ();
+    ch.SetWideningVisits (ch.WideningVisits () * max (Param::tree_widening_factor, 1.01f));
+  }
+}
+
+MctsNode* MctsNode::FindChild (Move m) {
+  // TODO make invariant about haveChildren and has_all_legal_children
+  Player pl = m.GetPlayer();
+  ASSERT (HasAllLegalChildren (pl));
+  uint ii = children [pl].Find (m.GetVertex());
+  if (ii == children [pl].Size ()) return NULL; // no child
+  return &children [pl].GetNode (pl, ii);
+}
+
+string MctsNode::ToString() const {
+  return parent->ToString (player, index);
+}
+
+string MctsNode::GuiString() const {
+  return parent->GuiString (player, index);
+}
+
 namespace {
-  bool SubjectiveCmp (const MctsNode* a, const MctsNode* b) {
-    return a->stat.update_count() > b->stat.update_count();
+  struct ChildRef {
+    const MctsChildren* children;
+    Player player;
+    uint index;
+
+    const Stat& GetStat () const { return children->GetStat (index); }
+  };
+
+  // Regular updates only, as reported to analysis tools.
+  uint Visits (const Stat& stat) {
+    return uint (max (0.0f, stat.update_count () - Param::prior_update_count));
+  }
+
+  bool SubjectiveCmp (const ChildRef& a, const ChildRef& b) {
+    return a.GetStat ().update_count() > b.GetStat ().update_count();
     // return SubjectiveMean () > b->SubjectiveMean ();
   }
 }
@@ -103,21 +345,26 @@ void MctsNode::RecPrint (ostream& out, uint depth, float min_visit, uint max_chi
   rep (d, depth) out << "  ";
   out << ToString () << endl;
 
-  vector <const MctsNode*> child_tab;
-  for (ChildrenList::const_iterator child = children.begin();
-       child != children.end();
-       ++child)
-  {
-    child_tab.push_back(&*child);
+  vector <ChildRef> child_tab;
+  ForEachNat (Player, pl) {
+    rep (ii, children [pl].Size ()) {
+      ChildRef child = { &children [pl], pl, ii };
+      child_tab.push_back (child);
+    }
   }
 
   sort (child_tab.begin(), child_tab.end(), SubjectiveCmp);
   if (child_tab.size () > max_children) child_tab.resize(max_children);
 
   rep(ii, child_tab.size()) {
-    const MctsNode* child = child_tab[ii];
-    if (child->stat.update_count() >= min_visit) {
-      child->RecPrint (out, depth + 1, min_visit, max(1u, max_children - 1));
+    const ChildRef& child = child_tab[ii];
+    if (child.GetStat ().update_count() < min_visit) continue;
+    const MctsNode* node = child.children->FindNode (child.index);
+    if (node != NULL) {
+      node->RecPrint (out, depth + 1, min_visit, max(1u, max_children - 1));
+    } else {
+      rep (d, depth + 1) out << "  ";
+      out << child.children->ToString (child.player, child.index) << endl;
     }
   }
 }
@@ -128,85 +375,252 @@ string MctsNode::RecToString (float min_visit, uint max_children) const {
   return out.str ();
 }
 
-const MctsNode& MctsNode::MostExploredChild (Player pl) const {
-  const MctsNode* best = NULL;
-  float best_update_count = -1;
-
-  ASSERT (has_all_legal_children [pl]);
+// Number of tree nodes at each depth below this one.
+void MctsNode::RecDepthCount (vector <uint>& histogram, uint depth) const {
+  ForEachNat (Player, pl) {
+    rep (ii, children [pl].Size ()) {
+      const MctsNode* node = children [pl].FindNode (ii);
+      if (node == NULL) continue;
+      if (histogram.size () <= depth) histogram.resize (depth + 1, 0);
+      histogram [depth] += 1;
+      node->RecDepthCount (histogram, depth + 1);
+    }
+  }
+}
 
-  for (ChildrenList::const_iterator child = children.begin();
-       child != children.end();
-       ++child)
-  {
-    if (child->player == pl && child->stat.update_count() > best_update_count) {
-      best_update_count = child->stat.update_count();
-      best = &*child;
+// Most visited allocated nodes, players alternate starting with pl.
+void MctsNode::GreedyPv (Player pl, uint max_length, vector <Vertex>* pv) const {
+  const MctsNode* node = this;
+  Player act = pl;
+  rep (depth, max_length) {
+    const MctsChildren& ch = node->children [act];
+    const MctsNode* best = NULL;
+    float best_count = 0.0;
+    rep (ii, ch.Size ()) {
+      if (ch.FindNode (ii) != NULL && ch.GetStat (ii).update_count () > best_count) {
+        best = ch.FindNode (ii);
+        best_count = ch.GetStat (ii).update_count ();
+      }
     }
+    if (best == NULL) break;
+    pv->push_back (best->GetVertex ());
+    node = best;
+    act = act.Other ();
   }
+}
 
-  ASSERT (best != NULL);
-  return *best;
+// info move C3 visits n winrate w order 0 pv C3 D4 ... info move ...
+// Leela Zero lz-analyze format: winrate is in 1/10000 for pl, visits
+// don't count the prior, moves without visits are skipped.
+string MctsNode::AnalyzeInfo (Player pl, uint max_moves, uint max_pv_length) const {
+  vector <ChildRef> child_tab;
+  rep (ii, children [pl].Size ()) {
+    if (Visits (children [pl].GetStat (ii)) == 0) continue;
+    ChildRef child = { &children [pl], pl, ii };
+    child_tab.push_back (child);
+  }
+  sort (child_tab.begin(), child_tab.end(), SubjectiveCmp);
+  if (child_tab.size () > max_moves) child_tab.resize (max_moves);
+
+  ostringstream out;
+  rep (ii, child_tab.size ()) {
+    const MctsChildren& ch = *child_tab [ii].children;
+    uint index = child_tab [ii].index;
+    const Stat& stat = ch.GetStat (index);
+    int winrate = int ((pl.SubjectiveScore (stat.mean ()) + 1.0) * 5000.0 + 0.5);
+    if (ii > 0) out << " ";
+    out << "info move " << ch.GetVertex (index).ToGtpString ()
+        << " visits " << Visits (stat)
+        << " winrate " << winrate
+        << " order " << ii
+        << " pv " << ch.GetVertex (index).ToGtpString ();
+    const MctsNode* node = ch.FindNode (index);
+    if (node == NULL) continue;
+    vector <Vertex> pv;
+    node->GreedyPv (pl.Other (), max_pv_length - 1, &pv);
+    rep (jj, pv.size ()) out << " " << pv [jj].ToGtpString ();
+  }
+  return out.str ();
 }
 
+// {"visits":n, "to_move":"B",
+//  "children":[{"move":"C3","visits":n,"mean":x,"rave_mean":x,"bias":x}, ...],
+//  "pv":["C3", ...], "depth":[n1, n2, ...]}
+// Children are sorted by visits, visits don't count the prior (as in
+// AnalyzeInfo), means are from the point of view of the player to
+// move. Depth counts allocated nodes, starting at 1.
+string MctsNode::ToJson (Player pl, uint max_children) const {
+  const uint kMaxPvLength = 50;
+  ostringstream out;
+  out << "{\"visits\":" << Visits (GetStat ())
+      << ",\"to_move\":\"" << pl.ToGtpString () << "\"";
 
-MctsNode& MctsNode::BestRaveChild (Player pl) {
-  MctsNode* best_child = NULL;
-  float best_urgency = -100000000000000.0; // TODO infinity
-  const float log_val = log (stat.update_count());
+  vector <ChildRef> child_tab;
+  rep (ii, children [pl].Size ()) {
+    ChildRef child = { &children [pl], pl, ii };
+    child_tab.push_back (child);
+  }
+  sort (child_tab.begin(), child_tab.end(), SubjectiveCmp);
+  if (max_children > 0 && child_tab.size () > max_children) child_tab.resize (max_children);
+
+  out << ",\"children\":[";
+  rep (ii, child_tab.size ()) {
+    const ChildRef& child = child_tab [ii];
+    const MctsChildren& ch = *child.children;
+    if (ii > 0) out << ",";
+    out << "{\"move\":\"" << ch.GetVertex (child.index).ToGtpString () << "\""
+        << ",\"visits\":" << Visits (ch.GetStat (child.index))
+        << ",\"mean\":" << pl.SubjectiveScore (ch.GetStat (child.index).mean ())
+        << ",\"rave_mean\":" << pl.SubjectiveScore (ch.GetRaveStat (child.index).mean ())
+        << ",\"bias\":" << ch.GetBias (child.index) << "}";
+  }
+  out << "]";
+
+  // Principal variation follows the most visited allocated nodes.
+  vector <Vertex> pv;
+  GreedyPv (pl, kMaxPvLength, &pv);
+  out << ",\"pv\":[";
+  rep (ii, pv.size ()) {
+    out << (ii > 0 ? "," : "") << "\"" << pv [ii].ToGtpString () << "\"";
+  }
+  out << "]";
 
-  ASSERT (has_all_legal_children [pl]);
+  vector <uint> histogram;
+  RecDepthCount (histogram, 0);
+  out << ",\"depth\":[";
+  rep (ii, histogram.size ()) out << (ii > 0 ? "," : "") << histogram [ii];
+  out << "]}";
+  return out.str ();
+}
 
-  for (ChildrenList::iterator child = children.begin();
-       child != children.end();
-       ++child)
-  {
-    if (child->player != pl) continue;
-    float child_urgency = child->SubjectiveRaveValue (pl, log_val);
-    if (child_urgency > best_urgency) {
-      best_urgency = child_urgency;
-      best_child   = &*child;
+const MctsNode& MctsNode::MostExploredChild (Player pl) {
+  uint best = 0;
+  float best_update_count = -1;
+
+  ASSERT (HasAllLegalChildren (pl));
+
+  rep (ii, children [pl].Size ()) {
+    if (children [pl].GetStat (ii).update_count() >= best_update_count) {
+      best_update_count = children [pl].GetStat (ii).update_count();
+      best = ii;
     }
   }
 
-  ASSERT (best_child != NULL); // at least pass
-  return *best_child;
+  return children [pl].GetNode (pl, best);
+}
+
+
+float MctsNode::VisitLead (Player pl) const {
+  float best = 0.0;
+  float second = 0.0;
+  rep (ii, children [pl].Size ()) {
+    float count = children [pl].GetStat (ii).update_count ();
+    if (count > best) {
+      second = best;
+      best = count;
+    } else if (count > second) {
+      second = count;
+    }
+  }
+  return best - second;
+}
+
+
+MctsNode& MctsNode::BestRaveChild (Player pl) {
+  const float log_val = log (GetStat ().update_count());
+
+  ASSERT (children [pl].Size () > 0);
+
+  uint best = children [pl].BestRave (pl, log_val);
+  return children [pl].GetNode (pl, best);
 }
 
 
 void MctsNode::Reset () {
-  has_all_legal_children.SetAll (false);
-  children.clear ();
-  stat.reset      (Param::prior_update_count,
-      player.SubjectiveScore (Param::prior_mean));
-  rave_stat.reset (Param::prior_update_count,
-      player.SubjectiveScore (Param::prior_mean));
+  ForEachNat (Player, pl) children [pl].Clear ();
+  parent->ResetStats (index, player);
 }
 
 float MctsNode::SubjectiveMean () const {
-  return player.SubjectiveScore (stat.mean ());
+  return player.SubjectiveScore (GetStat ().mean ());
 }
 
 float MctsNode::SubjectiveRaveValue (Player pl, float log_val) const {
-  float value;
+  return parent->SlowUrgency (index, pl, log_val);
+}
 
-  if (Param::tree_rave_use) {
-    value = Stat::Mix (stat,      Param::tree_stat_bias,
-        rave_stat, Param::tree_rave_bias);
-  } else {
-    value = stat.mean ();
+
+// -----------------------------------------------------------------------------
+
+string SelectionBenchmark (uint child_count, uint rounds) {
+  FastRandom random (123);
+  MctsChildren root_stats;
+  root_stats.Add (Vertex::Any (), 0.0);
+  MctsNode& node = root_stats.GetNode (Player::White (), 0);
+  node.Reset ();
+
+  // Synthetic children, only statistics matter.
+  Player pl = Player::Black ();
+  rep (ii, child_count) {
+    Vertex v = Vertex::OfRaw (ii % Vertex::kBound);
+    node.AddChild (pl, v, random.GetNextUint (1000) / 1000.0);
+    uint visits = random.GetNextUint (200);
+    uint rave_visits = random.GetNextUint (2000);
+    float win_rate = random.GetNextUint (1000) / 1000.0;
+    rep (jj, visits) {
+      node.children [pl].UpdateStat (ii, random.NextDouble () < win_rate ? 1.0 : -1.0);
+    }
+    rep (jj, rave_visits) {
+      node.children [pl].UpdateRaveStat (ii, random.NextDouble () < win_rate ? 1.0 : -1.0, 1.0);
+    }
+  }
+  rep (ii, 100 * child_count) node.UpdateStat (1.0);
+
+  const MctsChildren& children = node.children [pl];
+  const float log_val = log (node.GetStat ().update_count ());
+  uint dummy = 0;
+
+  FastTimer kernel_timer;
+  FastTimer slow_timer;
+  kernel_timer.overhead = slow_timer.overhead = FastTimer::MinOverhead ();
+  rep (ii, rounds) {
+    kernel_timer.Start ();
+    dummy += children.BestRave (pl, log_val);
+    kernel_timer.Stop ();
+
+    slow_timer.Start ();
+    uint best = 0;
+    float best_urgency = - numeric_limits <float>::infinity ();
+    rep (jj, children.Size ()) {
+      float urgency = children.SlowUrgency (jj, pl, log_val);
+      if (urgency >= best_urgency) {
+        best_urgency = urgency;
+        best = jj;
+      }
+    }
+    dummy += best;
+    slow_timer.Stop ();
   }
 
-  return
-    pl.SubjectiveScore (value)
-    + Param::tree_explore_coeff * sqrt (log_val / stat.update_count())
-    + Param::tree_progressive_bias * bias
-    / max (1.0f, (stat.update_count () + Param::tree_progressive_bias_prior));
-  // TODO other equation for PB
+  ostringstream ret;
+  char buf [200];
+  sprintf (buf, "%4d children  kernel %8.1f CC (%5.2f/child)  scalar %8.1f CC (%5.2f/child)",
+           child_count,
+           kernel_timer.Ticks (), kernel_timer.Ticks () / child_count,
+           slow_timer.Ticks (), slow_timer.Ticks () / child_count);
+  ret << buf;
+  if (dummy == 1) ret << " ";
+  return ret.str ();
 }
 
-
 // -----------------------------------------------------------------------------
 
+const uint MctsTrace::kNoPlay;
+
+MctsTrace::MctsTrace () : first_play (kNoPlay) {
+}
+
+
 void MctsTrace::Reset (MctsNode& node) {
   nodes.clear();
   nodes.push_back (&node);
@@ -226,9 +640,11 @@ void MctsTrace::NewMove (Move m) {
 
 
 void MctsTrace::UpdateTraceRegular (float score) {
-
-  rep (ii, nodes.size ()) {
-    nodes[ii]->stat.update (score);
+  {
+    PROFILE_PHASE (StatUpdate);
+    rep (ii, nodes.size ()) {
+      nodes[ii]->UpdateStat (score);
+    }
   }
 
   if (Param::tree_rave_update) {
@@ -237,36 +653,140 @@ void MctsTrace::UpdateTraceRegular (float score) {
 }
 
 
-void MctsTrace::UpdateTraceRave (float score) {
-  // TODO configure rave blocking through options
+uint MctsTrace::MoveCount () const {
+  return moves.size ();
+}
+
 
-  uint last_ii  = moves.size () * Param::tree_rave_update_fraction;
-  // TODO tune that
+void MctsTrace::TruncateMoves (uint move_count) {
+  ASSERT (move_count <= moves.size ());
+  moves.resize (move_count);
+}
 
-  rep (act_ii, nodes.size()) {
-    // Mark moves that should be updated in RAVE children of: trace [act_ii]
-    NatMap <Move, bool> do_update (false);
-    NatMap <Move, bool> do_update_set_to (true);
-    ForEachNat (Player, pl) do_update_set_to [Move (pl, Vertex::Pass())] = false;
 
-    // TODO this is the slow and too-fixed part
-    // TODO Change it to weighting with flexible masking.
-    reps (jj, act_ii+1, last_ii) {
+// One weighted update is the same as playout_cnt updates with scores
+// averaging to mean_score. RAVE is updated separately for each playout.
+void MctsTrace::UpdateTraceBatch (float mean_score, float playout_cnt) {
+  PROFILE_PHASE (StatUpdate);
+  rep (ii, nodes.size ()) {
+    nodes[ii]->UpdateStat (mean_score, playout_cnt);
+  }
+}
+
+
+// One backward pass over the playout. When it reaches node act_ii,
+// first_play holds the first play at each vertex after that node,
+// so each node only has to look up its children.
+void MctsTrace::UpdateTraceRave (float score) {
+  PROFILE_PHASE (RaveUpdate);
+  // With tree_rave_update_decay == 0 moves after last_ii are ignored,
+  // otherwise all moves count, with weights decaying along the playout.
+  uint last_ii = moves.size ();
+  if (Param::tree_rave_update_decay <= 0.0) {
+    last_ii = min (last_ii, uint (moves.size () * Param::tree_rave_update_fraction));
+  }
+
+  int jj = int (last_ii) - 1;
+
+  for (int act_ii = int (nodes.size ()) - 1; act_ii >= 0; act_ii--) {
+    for (; jj > act_ii; jj--) {
       Move m = moves [jj];
-      do_update [m] = do_update_set_to [m];
-      do_update_set_to [m] = false;
-      do_update_set_to [m.OtherPlayer()] = false;
+      if (m.GetVertex () == Vertex::Pass ()) continue;
+      first_play [m] = jj;
+      first_play [m.OtherPlayer ()] = kNoPlay;
     }
 
     // Do the update.
-    for (MctsNode::ChildrenList::iterator child = nodes[act_ii]->children.begin();
-	 child != nodes[act_ii]->children.end();
-	 ++child)
-    {
-      if (do_update [child->GetMove()]) {
-        child->rave_stat.update (score);
+    ForEachNat (Player, pl) {
+      MctsChildren& children = nodes[act_ii]->children [pl];
+      rep (ii, children.Size ()) {
+        uint play_ii = first_play [Move (pl, children.GetVertex (ii))];
+        if (play_ii != kNoPlay) {
+          children.UpdateRaveStat (ii, score, RaveWeight (act_ii, play_ii));
+        }
+      }
+    }
+  }
+
+  // Clean up for the next playout.
+  rep (ii, last_ii) {
+    first_play [moves [ii]] = kNoPlay;
+    first_play [moves [ii].OtherPlayer ()] = kNoPlay;
+  }
+}
+
+
+float MctsTrace::RaveWeight (uint act_ii, uint jj) const {
+  if (Param::tree_rave_update_decay <= 0.0) return 1.0;
+  float distance = float (jj - act_ii - 1) / moves.size ();
+  return max (0.0f, 1.0f - Param::tree_rave_update_decay * distance);
+}
+
+// -----------------------------------------------------------------------------
+
+void PvCache::Rebuild (MctsNode& root, Player pl) {
+  nodes.clear ();
+  nodes.push_back (&root);
+  root_player = pl;
+  Extend ();
+}
+
+
+void PvCache::Update (const MctsTrace& trace) {
+  const vector <MctsNode*>& path = trace.Nodes ();
+  if (nodes.empty () || path.empty () || path [0] != nodes [0]) return;
+
+  uint d = 1;
+  while (d < path.size () && d < nodes.size () && path [d] == nodes [d]) d++;
+  if (d == path.size ()) return;
+
+  if (d == nodes.size ()) {
+    // Trace went below the end of the line, nodes there are new.
+    while (d < path.size () && nodes.size () <= kMaxLength) {
+      nodes.push_back (path [d]);
+      d++;
+    }
+    return;
+  }
+
+  // path [d] and nodes [d] are siblings.
+  if (path [d]->GetStat ().update_count () > nodes [d]->GetStat ().update_count ()) {
+    nodes.resize (d);
+    nodes.push_back (path [d]);
+    Extend ();
+  }
+}
+
+
+uint PvCache::Size () const {
+  return nodes.size () - 1;
+}
+
+
+const MctsNode& PvCache::Get (uint ii) const {
+  ASSERT (ii + 1 < nodes.size ());
+  return *nodes [ii + 1];
+}
+
+
+// Follows the most visited allocated children, ties go to the last one
+// as in MctsNode::MostExploredChild.
+void PvCache::Extend () {
+  while (nodes.size () <= kMaxLength) {
+    const MctsNode* node = nodes.back ();
+    Player pl = nodes.size () == 1 ? root_player : node->player.Other ();
+    const MctsChildren& children = node->children [pl];
+    MctsNode* best = NULL;
+    float best_count = -1.0;
+    rep (ii, children.Size ()) {
+      MctsNode* child = children.FindNode (ii);
+      if (child != NULL && children.GetStat (ii).update_count () >= best_count) {
+        best = child;
+        best_count = children.GetStat (ii).update_count ();
       }
     }
+    if (best == NULL) return;
+    nodes.push_back (best);
   }
 }
 
@@ -1,18 +1,103 @@
 #ifndef MCTS_TREE_
 #define MCTS_TREE_
 
-#include <list>
 #include "stat.hpp"
 #include "gtp.hpp"
 
 
-class MctsNode {
+class MctsNode;
+
+// Children of a node played by one player. Their statistics are kept
+// here, in parallel arrays, and not in the child nodes, so that
+// selection is a single pass over contiguous memory. Child nodes are
+// allocated on the first descent into them (GetNode).
+class MctsChildren {
 public:
-  typedef std::list<MctsNode> ChildrenList; // TODO vector, allocator?
+  MctsChildren ();
+  ~MctsChildren ();
+
+  void Clear ();
+  void Add (Vertex v, float bias);
+  void Remove (uint ii); // The last child takes the place of ii.
+
+  // Progressive widening candidates are listed after the children, best
+  // first, and become children in that order (UnlockNext).
+  void AddLocked (Vertex v, float bias);
+  void UnlockNext ();
+
+  uint Size () const { return size; }
+  uint ListedSize () const { return listed; }  // children and candidates
+
+  // All legal moves are children, see Engine::WidenChildren.
+  bool IsComplete () const { return complete && size == listed; }
+  void SetComplete () { complete = true; size = listed; }
+
+  // All legal moves are listed, some may be locked candidates.
+  bool IsListed () const { return complete; }
+  void SetListed () { complete = true; }
+
+  // Visits of the node at which the next candidate is unlocked.
+  float WideningVisits () const { return widening_visits; }
+  void SetWideningVisits (float visits) { widening_visits = visits; }
+
+  Vertex GetVertex (uint ii) const { return Vertices () [ii]; }
+  float GetBias (uint ii) const { return Biases () [ii]; }
+  const Stat& GetStat (uint ii) const { return Stats () [ii]; }
+  const Stat& GetRaveStat (uint ii) const { return RaveStats () [ii]; }
+
+  void ResetStats (uint ii, Player pl);
+  void UpdateStat (uint ii, float score, float weight = 1.0);
+  void UpdateRaveStat (uint ii, float score, float weight);
+
+  // NULL if the child node was not created yet.
+  MctsNode* FindNode (uint ii) const { return Nodes () [ii]; }
+  MctsNode& GetNode (Player pl, uint ii);
+
+  // Index of the child, Size () if there is none.
+  uint Find (Vertex v) const;
+
+  // Index of the child with the highest urgency, ties go to the last one.
+  uint BestRave (Player pl, float log_val) const;
 
+  // Reference implementation of a single child urgency.
+  float SlowUrgency (uint ii, Player pl, float log_val) const;
+
+  string ToString (Player pl, uint ii) const;
+  string GuiString (Player pl, uint ii) const;
+
+private:
+  MctsChildren (const MctsChildren&);
+  void operator= (const MctsChildren&);
+
+  void Grow ();
+  void CopyEntry (uint from, uint to);
+
+  // Layout of data: capacity entries of each array below, in this order.
+  MctsNode** Nodes () const { return reinterpret_cast <MctsNode**> (data); }
+  Stat* Stats () const { return reinterpret_cast <Stat*> (Nodes () + capacity); }
+  Stat* RaveStats () const { return Stats () + capacity; }
+  float* InvSqrtCounts () const { return reinterpret_cast <float*> (RaveStats () + capacity); }
+  float* Biases () const { return InvSqrtCounts () + capacity; }
+  Vertex* Vertices () const { return reinterpret_cast <Vertex*> (Biases () + capacity); }
+
+  static const uint kEntrySize =
+    sizeof (MctsNode*) + 2 * sizeof (Stat) + 2 * sizeof (float) + sizeof (Vertex);
+
+  char* data;
+  uint size;
+  float widening_visits;
+  unsigned short capacity;
+  unsigned short listed;
+  bool complete;
+};
+
+// -----------------------------------------------------------------------------
+
+class MctsNode {
+public:
   // Initialization.
 
-  explicit MctsNode (Player player, Vertex v, double bias);
+  explicit MctsNode (MctsChildren* parent, uint index, Player player);
 
   void Reset ();
 
@@ -23,19 +108,35 @@ public:
 
   string RecToString (float min_visit, uint max_children) const; 
 
+  // One line JSON for analysis tools, pl is the player to move.
+  // max_children == 0 - all of them.
+  string ToJson (Player pl, uint max_children) const;
+
+  // Visited children of pl in lz-analyze "info move ..." format, on
+  // one line, best first.
+  string AnalyzeInfo (Player pl, uint max_moves, uint max_pv_length) const;
+
   // Children operations.
   
-  void AddChild (const MctsNode& node);
+  void AddChild (Player pl, Vertex v, float bias);
 
-  void RemoveChild (MctsNode* child_ptr);
+  void RemoveChild (Player pl, Vertex v);
 
   bool ReadyToExpand () const;
 
+  bool HasAllLegalChildren (Player pl) const;
+
+  // Unlocks listed candidates of pl as progressive widening allows.
+  void Widen (Player pl);
+
   // Child finding.
 
   MctsNode* FindChild (Move m);
 
-  const MctsNode& MostExploredChild (Player pl) const;
+  const MctsNode& MostExploredChild (Player pl);
+
+  // Visits of the most explored child minus visits of the runner-up.
+  float VisitLead (Player pl) const;
 
   MctsNode& BestRaveChild (Player pl);
 
@@ -45,27 +146,40 @@ public:
 
   float SubjectiveRaveValue (Player pl, float log_val) const;
 
+  void UpdateStat (float score, float weight = 1.0);
+
 public:
 
   Move GetMove () const;
+  Vertex GetVertex () const;
+  float GetBias () const;
+  const Stat& GetStat () const;
+  const Stat& GetRaveStat () const;
 
-  Player player;
-  Vertex v;
-  NatMap <Player, bool> has_all_legal_children;
+  void RecPrint (ostream& out, uint depth, float min_visit, uint max_children) const;
+  void RecDepthCount (vector <uint>& histogram, uint depth) const;
+  void GreedyPv (Player pl, uint max_length, vector <Vertex>* pv) const;
 
-  Stat stat;
-  Stat rave_stat;
-  const double bias;
+  NatMap <Player, MctsChildren> children;
 
-  void RecPrint (ostream& out, uint depth, float min_visit, uint max_children) const;
+private:
+  friend class MctsChildren;
 
-  ChildrenList children;
+  MctsChildren* parent; // holds statistics of this node
+  uint index;
+
+public:
+  Player player;
 };
 
+// Selection benchmark on a synthetic node, CC per selection.
+string SelectionBenchmark (uint child_count, uint rounds);
+
 // -----------------------------------------------------------------------------
 
 struct MctsTrace {
 public:
+  MctsTrace ();
 
   void Reset (MctsNode& node);
   void NewMove (Move m);
@@ -73,9 +187,50 @@ public:
   void UpdateTraceRegular (float score);
   void UpdateTraceRave (float score);
 
+  // Leaf-parallel playouts (Engine::DoLeafPlayouts) share the moves
+  // up to the leaf, TruncateMoves goes back to the leaf.
+  uint MoveCount () const;
+  void TruncateMoves (uint move_count);
+  void UpdateTraceBatch (float mean_score, float playout_cnt);
+
+  const vector <MctsNode*>& Nodes () const { return nodes; }
+
 private:
+  float RaveWeight (uint act_ii, uint jj) const;
+
   vector <MctsNode*> nodes;
   vector <Move> moves;
+
+  // Index in moves of the first play at a vertex (by any player)
+  // after a given point of the trace, kNoPlay if there is none.
+  static const uint kNoPlay = -1;
+  NatMap <Move, uint> first_play;
+};
+
+// -----------------------------------------------------------------------------
+
+// Principal variation: the most visited child at each level, starting
+// from a root. Only nodes on a playout trace change their counts, so
+// Update needs to look at the one level where the trace leaves the
+// line. A walk down the tree happens only when the leader changes.
+// On equal counts the current leader stays.
+class PvCache {
+public:
+  static const uint kMaxLength = 50;
+
+  // pl is the player to move at root.
+  void Rebuild (MctsNode& root, Player pl);
+  void Update (const MctsTrace& trace);
+
+  // Without the root.
+  uint Size () const;
+  const MctsNode& Get (uint ii) const;
+
+private:
+  void Extend ();
+
+  vector <MctsNode*> nodes; // nodes [0] is the root
+  Player root_player;
 };
 
 // -----------------------------------------------------------------------------
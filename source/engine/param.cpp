@@ -13,6 +13,13 @@ float Param::tree_rave_bias   = 0.001;
 float Param::tree_progressive_bias = 100.0;
 float Param::tree_progressive_bias_prior = 1.0;
 float Param::tree_rave_update_fraction = 0.75;
+float Param::tree_rave_update_decay = 0.0;
+float Param::tree_widening_base = 0.0; // 0 - all legal moves at once
+float Param::tree_widening_start = 40.0;
+float Param::tree_widening_factor = 1.4;
+uint  Param::tree_leaf_playouts = 1;
+bool  Param::tree_dump = true; // RecToString to cerr on every SyncRoot
+uint  Param::pv_report_period = 0; // playouts, 0 - no gogui-gfx PV on cerr
 
 float Param::prior_update_count = 10.0;
 float Param::prior_mean = 1.0;
@@ -20,3 +27,11 @@ float Param::prior_mean = 1.0;
 float Param::mature_update_count = 10.0;
 
 float Param::resign_mean = -0.90;
+
+float Param::dynamic_komi_step = 0.0; // 0 - playouts use the game komi
+float Param::dynamic_komi_high = 0.7;
+float Param::dynamic_komi_low  = -0.1;
+float Param::dynamic_komi_max  = 30.0;
+
+float Param::score_weight = 0.0; // 0 - only a tiny bonus for bigger win
+float Param::score_scale  = 10.0;
@@ -18,6 +18,13 @@ public:
   static float tree_progressive_bias;
   static float tree_progressive_bias_prior;
   static float tree_rave_update_fraction;
+  static float tree_rave_update_decay;
+  static float tree_widening_base;
+  static float tree_widening_start;
+  static float tree_widening_factor;
+  static uint  tree_leaf_playouts;
+  static bool  tree_dump;
+  static uint  pv_report_period;
 
   static float prior_update_count;
   static float prior_mean;
@@ -25,6 +32,14 @@ public:
   static float mature_update_count;
 
   static float resign_mean;
+
+  static float dynamic_komi_step;
+  static float dynamic_komi_high;
+  static float dynamic_komi_low;
+  static float dynamic_komi_max;
+
+  static float score_weight;
+  static float score_scale;
 };
 
 #endif /* GO_PARAM_H */
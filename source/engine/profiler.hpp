@@ -0,0 +1,122 @@
+#ifndef PROFILER_H_
+#define PROFILER_H_
+
+#include "ego.hpp"
+
+// Cycles spent in the phases of a playout, summed from the last
+// PROFILE_RESET (start of each genmove search). Probes are scoped:
+// PROFILE_PHASE (Sample) times the rest of the enclosing block.
+//
+// Probes exist only with EGO_PROFILE defined (cmake -DEGO_PROFILE=ON).
+// Otherwise the macros expand to nothing and the engine compiles to
+// the same code as without them.
+
+class PhaseProfiler {
+public:
+  enum Phase {
+    Search,        // whole genmove search, the others are parts of it
+    Prepare,       // Engine::PrepareToPlayout
+    TreeMove,      // Engine::ChooseMctsMove
+    Sample,        // Sampler::SampleMove
+    PlayLegal,     // Board::PlayLegal
+    SamplerUpdate, // Sampler::MovePlayed
+    Score,         // Engine::Score
+    StatUpdate,    // MctsTrace, regular statistics
+    RaveUpdate,    // MctsTrace::UpdateTraceRave
+    kPhaseCount
+  };
+
+  static PhaseProfiler& Get () {
+    static PhaseProfiler profiler;
+    return profiler;
+  }
+
+  static bool Enabled () {
+#ifdef EGO_PROFILE
+    return true;
+#else
+    return false;
+#endif
+  }
+
+  void Reset () {
+    rep (ii, kPhaseCount) {
+      cc [ii] = 0;
+      sample_cnt [ii] = 0;
+    }
+  }
+
+  void Add (Phase phase, uint64 ticks) {
+    cc [phase] += ticks;
+    sample_cnt [phase] += 1;
+  }
+
+  // CC (without probe overhead), CC per playout and percent of Search
+  // for each phase.
+  string ToString () const {
+    static const char* const kNames [kPhaseCount] = {
+      "search", "prepare", "tree_move", "sample", "play_legal",
+      "sampler_update", "score", "stat_update", "rave_update"
+    };
+    double playouts = max (sample_cnt [Prepare], uint64 (1));
+    double phase_cc [kPhaseCount];
+    double parts = 0.0;
+    rep (ii, kPhaseCount) {
+      phase_cc [ii] = max (0.0, cc [ii] - sample_cnt [ii] * overhead);
+      if (ii != Search) parts += phase_cc [ii];
+    }
+    double total = max (phase_cc [Search], 1.0);
+
+    ostringstream out;
+    char buf [200];
+    sprintf (buf, "%-15s %14s %12s %7s", "phase", "CC", "CC/playout", "%");
+    out << buf << endl;
+    rep (ii, kPhaseCount + 1) {
+      const char* name = ii < kPhaseCount ? kNames [ii] : "other";
+      double x = ii < kPhaseCount ? phase_cc [ii] : max (0.0, phase_cc [Search] - parts);
+      sprintf (buf, "%-15s %14.0f %12.1f %7.2f", name, x, x / playouts, 100.0 * x / total);
+      out << buf << endl;
+    }
+    out << uint64 (playouts) << " playouts";
+    return out.str ();
+  }
+
+private:
+  PhaseProfiler () : overhead (FastTimer::MinOverhead ()) {
+    Reset ();
+  }
+
+  uint64 cc [kPhaseCount];
+  uint64 sample_cnt [kPhaseCount];
+  double overhead;
+};
+
+
+#ifdef EGO_PROFILE
+
+class ProfileProbe {
+public:
+  explicit ProfileProbe (PhaseProfiler::Phase phase)
+    : phase (phase), start (FastTimer::GetCcTime ()) {
+  }
+
+  ~ProfileProbe () {
+    PhaseProfiler::Get ().Add (phase, FastTimer::GetCcTime () - start);
+  }
+
+private:
+  PhaseProfiler::Phase phase;
+  uint64 start;
+};
+
+#define PROFILE_PHASE(phase) ProfileProbe profile_probe (PhaseProfiler::phase)
+#define PROFILE_RESET() PhaseProfiler::Get ().Reset ()
+
+#else
+
+#define PROFILE_PHASE(phase)
+#define PROFILE_RESET()
+
+#endif
+
+#endif
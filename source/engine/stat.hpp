@@ -5,6 +5,8 @@
 #include "param.hpp"
 #include "ego.hpp"
 
+// Count, mean and mean of squares (for the variance Mix needs), 12
+// bytes. Means are updated incrementally.
 class Stat {
 public:
 
@@ -15,17 +17,26 @@ public:
   }
   
   // TODO better prior initialization
+  // Prior samples count twice in E(X^2) (2 * prior_mean^2) to keep the
+  // early variance away from 0.
   void reset (float prior_count, float prior_mean) {
     sample_count       = prior_count;
-    sample_sum         = prior_count * prior_mean;
-    square_sample_sum  = prior_count * prior_mean * prior_mean * 2.0;
-    ucb = 1.0E20;
+    sample_mean        = prior_mean;
+    sample_square_mean = prior_mean * prior_mean * 2.0;
   }
 
   void update (float sample) {
     sample_count       += 1.0;
-    sample_sum         += sample;
-    square_sample_sum  += sample * sample;
+    sample_mean        += (sample - sample_mean) / sample_count;
+    sample_square_mean += (sample * sample - sample_square_mean) / sample_count;
+  }
+
+  // Sample counted as a fraction of a regular one.
+  void update (float sample, float weight) {
+    if (weight == 0.0) return;  // would be 0/0 on an empty Stat
+    sample_count       += weight;
+    sample_mean        += weight * (sample - sample_mean) / sample_count;
+    sample_square_mean += weight * (sample * sample - sample_square_mean) / sample_count;
   }
 
   float update_count () const {
@@ -33,13 +44,18 @@ public:
   }
 
   float mean () const { 
-    return sample_sum / sample_count; 
+    return sample_mean;
+  }
+
+  float square_mean () const {
+    return sample_square_mean;
   }
 
   float variance () const {
-    // VX = E(X^2) - EX ^ 2
+    // VX = E(X^2) - EX ^ 2, rounding of the incremental means can make
+    // it slightly negative.
     float m = mean ();
-    return square_sample_sum / sample_count - m * m;
+    return max (0.0f, square_mean () - m * m);
   }
 
   float std_dev () const { 
@@ -55,43 +71,28 @@ public:
     return 1.0 / (variance() / update_count () + bias);
   }
 
-  void UpdateUcb (Player pl, float explore_coeff) {
-    ucb = pl.SubjectiveScore (mean());
-    ucb += explore_coeff / sqrt (update_count());
-  }
-
-  float Ucb () {
-    return ucb;
-  }
-
   static float SlowMix (const Stat& stat1, float b1, const Stat& stat2, float b2) {
     return
       (stat1.precision(b1) * stat1.mean() + stat2.precision(b2) * stat2.mean()) /
       (stat1.precision(b1) + stat2.precision(b2));
   }
 
-  // Optimized SlowMix
+  // Optimized SlowMix, y = n / precision.
   static float Mix (const Stat& stat1, float b1, const Stat& stat2, float b2) {
 
     float n1 = stat1.sample_count;
     float n2 = stat2.sample_count;
 
-    float s1 = stat1.sample_sum;
-    float s2 = stat2.sample_sum;
-
-    float v1 = stat1.square_sample_sum;
-    float v2 = stat2.square_sample_sum;
+    float m1 = stat1.sample_mean;
+    float m2 = stat2.sample_mean;
 
-    float nn1 = n1 * n1;
-    float nn2 = n2 * n2;
+    float y1 = stat1.variance () + b1 * n1;
+    float y2 = stat2.variance () + b2 * n2;
 
-    float x1 = (v1 + b1*nn1) * n1  -  s1 * s1;
-    float x2 = (v2 + b2*nn2) * n2  -  s2 * s2;
+    float t1 = y2 * n1;
+    float t2 = y1 * n2;
 
-    float t1 = nn1 * x2;
-    float t2 = nn2 * x1;
-
-    float mix = (t1*s1 + t2*s2) / (t1*n1 + t2*n2);
+    float mix = (t1*m1 + t2*m2) / (t1 + t2);
 
     ASSERT (fabs(mix - SlowMix(stat1, b1, stat2 ,b2)) < 0.00001);
     return mix;
@@ -110,9 +111,36 @@ public:
 
 private:
   float sample_count;
-  float sample_sum;
-  float square_sample_sum;
-  float ucb;
+  float sample_mean;
+  float sample_square_mean;
+};
+
+// -----------------------------------------------------------------------------
+
+// 1/sqrt of visit counts. Counts of MCTS statistics are integers (prior
+// and regular updates), small ones are precomputed.
+class VisitTable {
+public:
+  static const uint kSize = 1 << 14;
+
+  static const VisitTable& Get () {
+    static const VisitTable table;
+    return table;
+  }
+
+  float InvSqrt (float count) const {
+    uint n = uint (count);
+    if (n < kSize && float (n) == count) return inv_sqrt [n];
+    return 1.0 / sqrt (count);
+  }
+
+private:
+  VisitTable () {
+    inv_sqrt [0] = 1.0 / 0.0;
+    reps (n, 1, kSize) inv_sqrt [n] = 1.0 / sqrt (double (n));
+  }
+
+  float inv_sqrt [kSize];
 };
 
 // -----------------------------------------------------------------------------
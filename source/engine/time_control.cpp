@@ -12,19 +12,138 @@ extern Gtp::ReplWithGogui gtp;
 TimeControl::TimeControl () :
     time_left (0.0),
     time_stones (-1),
-    playouts_per_second (10000)
+    playouts_per_second (10000),
+    main_time (0.0),
+    byo_yomi_time (0.0),
+    byo_yomi_stones (0),
+    safety_margin (1.0),
+    min_moves_to_go (10.0),
+    empty_per_move (3.0),
+    early_stop_period (0),
+    playout_bank (0.0),
+    playout_bank_use (0.0),
+    replay_playouts (0),
+    search_cnt (0),
+    last_playouts (0),
+    genmove_cnt (0),
+    playouts_done (0.0),
+    playouts_saved (0.0),
+    search_player (Player::Black ()),
+    search_start_time (0.0),
+    search_start_cc (0),
+    playouts_from_bank (0.0),
+    deadline_active (false),
+    deadline_cc (0),
+    cc_per_second (0.0)
   {
     gtp.Register ("time_left", this, &TimeControl::GtpTimeLeft);
+    gtp.Register ("time_settings", this, &TimeControl::GtpTimeSettings);
+    gtp.Register ("time_stats", this, &TimeControl::GtpTimeStats);
+
+    gtp.RegisterParam ("param.time", "safety_margin",   &safety_margin);
+    gtp.RegisterParam ("param.time", "min_moves_to_go", &min_moves_to_go);
+    gtp.RegisterParam ("param.time", "empty_per_move",  &empty_per_move);
+    gtp.RegisterParam ("param.time", "early_stop_period", &early_stop_period);
+    gtp.RegisterParam ("param.time", "playout_bank_use",  &playout_bank_use);
+  }
+
+  // Upper limit, the search also stops at the MoveTime deadline.
+  uint TimeControl::PlayoutCount (Player) {
+    playouts_from_bank = 0.0;
+    if (replay_playouts > 0) return replay_playouts;
+    playouts_from_bank = min (playout_bank, playout_bank_use * Param::genmove_playouts);
+    return uint (Param::genmove_playouts + playouts_from_bank);
+  }
+
+  float TimeControl::MoveTime (Player player, uint empty_vertex_cnt) {
+    if (time_stones [player] < 0) return 0.0; // no time limit
+
+    float seconds;
+    float available = time_left [player] - safety_margin;
+    if (time_stones [player] > 0) {
+      // Byo-yomi period.
+      seconds = available / time_stones [player];
+    } else {
+      // Main time, byo-yomi (if any) is available for each move too.
+      float moves_to_go = max (min_moves_to_go, empty_vertex_cnt / empty_per_move);
+      seconds = available / moves_to_go;
+      if (byo_yomi_stones > 0) {
+        float byo_yomi_move = (byo_yomi_time - safety_margin) / byo_yomi_stones;
+        seconds = max (seconds, 0.0f) + max (byo_yomi_move, 0.0f);
+      }
+    }
+
+    return max (seconds, 0.01f);
+  }
+
+  void TimeControl::StartSearch (Player player, uint empty_vertex_cnt) {
+    float seconds = MoveTime (player, empty_vertex_cnt);
+    double cc_rate = CcPerSecond ();
+    search_player = player;
+    search_start_time = WallTime ();
+    search_start_cc = FastTimer::GetCcTime ();
+    deadline_active = seconds > 0.0 && replay_playouts == 0;
+    deadline_cc = search_start_cc + uint64 (seconds * cc_rate);
+  }
+
+  // Updates speed estimates and, when the controller does not send
+  // time_left, the remaining time.
+  void TimeControl::StopSearch (uint playouts, uint saved) {
+    double seconds = WallTime () - search_start_time;
+    uint64 cc = FastTimer::GetCcTime () - search_start_cc;
+    deadline_active = false;
+
+    if (seconds > 0.1) {
+      cc_per_second = cc / seconds;
+      float measured = playouts / seconds;
+      playouts_per_second = 0.5 * (playouts_per_second + measured);
+    }
+    cerr << "search: " << playouts << " playouts in " << seconds << " s, "
+         << playouts_per_second << " playouts/s, " << saved << " saved" << endl;
+
+    search_cnt += 1;
+    last_playouts = playouts;
+    genmove_cnt += 1;
+    playouts_done += playouts;
+    playouts_saved += saved;
+    // Only an early stop saves playouts. Searches cut by the deadline
+    // or by stop don't, and playouts taken from the bank are spent
+    // unless the early stop saved them.
+    playout_bank = max (0.0f, playout_bank - playouts_from_bank + saved);
+    playouts_from_bank = 0.0;
+
+    Player pl = search_player;
+    if (time_stones [pl] < 0) return;
+    time_left [pl] -= seconds;
+    if (time_stones [pl] > 0) {
+      time_stones [pl] -= 1;
+      if (time_stones [pl] == 0 && time_left [pl] > 0.0) {
+        time_left [pl] = byo_yomi_time; // new period
+        time_stones [pl] = byo_yomi_stones;
+      }
+    } else if (time_left [pl] <= 0.0 && byo_yomi_stones > 0) {
+      time_left [pl] += byo_yomi_time;
+      time_stones [pl] = byo_yomi_stones;
+    }
   }
 
-  uint TimeControl::PlayoutCount (Player player) {
-    int playouts = Param::genmove_playouts;
-    if (time_stones [player] == 0 && time_left [player] < 60.0) {
-      playouts = min (playouts,
-                      int (time_left [player] / 30.0 * playouts_per_second));
-      playouts = max (playouts, 1000);
+  float TimeControl::RemainingPlayouts () const {
+    if (!deadline_active) return 1.0E20;
+    uint64 now = FastTimer::GetCcTime ();
+    if (now >= deadline_cc) return 0.0;
+    return (deadline_cc - now) / cc_per_second * playouts_per_second;
+  }
+
+  // rdtsc rate, measured once against the wall clock and then after
+  // each search.
+  double TimeControl::CcPerSecond () {
+    if (cc_per_second == 0.0) {
+      double t1 = WallTime ();
+      uint64 cc1 = FastTimer::GetCcTime ();
+      while (WallTime () - t1 < 0.02) {}
+      cc_per_second = (FastTimer::GetCcTime () - cc1) / (WallTime () - t1);
     }
-    return playouts;
+    return cc_per_second;
   }
 
   void TimeControl::GtpTimeLeft (Gtp::Io& io) {
@@ -34,3 +153,39 @@ TimeControl::TimeControl () :
     time_left [pl] = seconds;
     time_stones [pl] = stones;
   }
+
+  // Early stop statistics, resets them.
+  void TimeControl::GtpTimeStats (Gtp::Io& io) {
+    io.CheckEmpty ();
+    io.out << "genmoves: " << genmove_cnt
+           << ", playouts/genmove: " << playouts_done / max (genmove_cnt, 1u)
+           << ", saved/genmove: " << playouts_saved / max (genmove_cnt, 1u)
+           << ", bank: " << playout_bank;
+    genmove_cnt = 0;
+    playouts_done = 0.0;
+    playouts_saved = 0.0;
+  }
+
+  void TimeControl::GtpTimeSettings (Gtp::Io& io) {
+    main_time = io.Read<float> ();
+    byo_yomi_time = io.Read<float> ();
+    byo_yomi_stones = io.Read<int> ();
+    io.CheckEmpty ();
+
+    if (byo_yomi_stones > 0 && byo_yomi_time <= 0.0) {
+      byo_yomi_stones = 0;
+    }
+    bool no_limit = main_time <= 0.0 && byo_yomi_stones == 0 && byo_yomi_time <= 0.0;
+    ForEachNat (Player, pl) {
+      if (no_limit) {
+        time_left [pl] = 0.0;
+        time_stones [pl] = -1;
+      } else if (main_time > 0.0 || byo_yomi_stones == 0) {
+        time_left [pl] = main_time;
+        time_stones [pl] = 0;
+      } else {
+        time_left [pl] = byo_yomi_time;
+        time_stones [pl] = byo_yomi_stones;
+      }
+    }
+  }
@@ -6,18 +6,81 @@
 #define TIME_CONTROL_H
 
 #include "utils.hpp"
+#include "fast_timer.hpp"
 #include "player.hpp"
 #include "gtp_gogui.hpp"
 
+// Search budget for genmove. Time comes from GTP time_settings and
+// time_left, playout speed is measured during searches. The deadline
+// is checked with rdtsc, so it can be checked after every playout.
 class TimeControl {
 public:
   TimeControl ();
+
   uint PlayoutCount (Player player);
+
+  // Seconds for the next move, 0.0 if there is no time limit.
+  // Remaining moves are estimated from the number of empty vertices.
+  float MoveTime (Player player, uint empty_vertex_cnt);
+
+  void StartSearch (Player player, uint empty_vertex_cnt);
+  void StopSearch (uint playouts, uint playouts_saved);
+
+  bool IsTimeUp () const {
+    return deadline_active && FastTimer::GetCcTime () > deadline_cc;
+  }
+
+  // Playouts that fit before the deadline at the measured speed.
+  float RemainingPlayouts () const;
+
   void GtpTimeLeft (Gtp::Io& io);
+  void GtpTimeSettings (Gtp::Io& io);
+  void GtpTimeStats (Gtp::Io& io);
 
   NatMap <Player, float> time_left;
   NatMap <Player, int>   time_stones;
   float playouts_per_second;
+
+  float main_time;
+  float byo_yomi_time;
+  int   byo_yomi_stones;
+
+  float safety_margin;     // seconds kept for network lag
+  float min_moves_to_go;
+  float empty_per_move;    // empty vertices per own remaining move
+
+  // Early stop: every early_stop_period playouts (0 - never, default) genmove
+  // checks whether the most explored move is decided. Saved time stays
+  // in time_left, saved playouts go to playout_bank. Up to
+  // playout_bank_use * genmove_playouts can be taken from the bank
+  // by a single move.
+  uint  early_stop_period;
+  float playout_bank;
+  float playout_bank_use;
+
+  // Replay: when non-zero every search does exactly that many
+  // playouts, without deadline and early stop.
+  uint replay_playouts;
+
+  // Searches since start and the playout count of the last one.
+  uint search_cnt;
+  uint last_playouts;
+
+  // Statistics since the last time_stats call.
+  uint   genmove_cnt;
+  double playouts_done;
+  double playouts_saved;
+
+private:
+  double CcPerSecond ();
+
+  Player search_player;
+  double search_start_time;
+  uint64 search_start_cc;
+  float playouts_from_bank;   // by the last PlayoutCount
+  bool deadline_active;
+  uint64 deadline_cc;
+  double cc_per_second;
 };
 
 #endif /* TIME_CONTROL_H */
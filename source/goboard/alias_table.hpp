@@ -0,0 +1,93 @@
+#ifndef _ALIAS_TABLE_HPP
+#define _ALIAS_TABLE_HPP
+
+#include "board.hpp"
+
+// Walker's alias method over a set of vertices.
+// Weights are frozen by Build (), after that Sample is O(1).
+
+class AliasTable {
+public:
+  AliasTable () : size (0), total (0.0), weight (0.0) {
+  }
+
+  void Clear () {
+    rep (ii, size) weight [vertex [ii]] = 0.0;
+    size = 0;
+    total = 0.0;
+  }
+
+  // Weights have to be positive. Call Build () after all Add's.
+  void Add (Vertex v, double w) {
+    ASSERT (w > 0.0);
+    ASSERT (weight [v] == 0.0);
+    ASSERT (size < kMaxSize);
+    vertex [size] = v;
+    weight [v] = w;
+    total += w;
+    size += 1;
+  }
+
+  void Build () {
+    uint small [kMaxSize];
+    uint large [kMaxSize];
+    uint small_cnt = 0;
+    uint large_cnt = 0;
+
+    rep (ii, size) {
+      prob [ii] = weight [vertex [ii]] * size / total;
+      alias [ii] = ii;
+      if (prob [ii] < 1.0) {
+        small [small_cnt++] = ii;
+      } else {
+        large [large_cnt++] = ii;
+      }
+    }
+
+    while (small_cnt > 0 && large_cnt > 0) {
+      uint s = small [--small_cnt];
+      uint l = large [large_cnt-1];
+      alias [s] = l;
+      prob [l] -= 1.0 - prob [s];
+      if (prob [l] < 1.0) {
+        large_cnt -= 1;
+        small [small_cnt++] = l;
+      }
+    }
+
+    // Leftovers are due to rounding errors only.
+    rep (ii, small_cnt) prob [small [ii]] = 1.0;
+    rep (ii, large_cnt) prob [large [ii]] = 1.0;
+  }
+
+  Vertex Sample (FastRandom& random) const {
+    ASSERT (size > 0);
+    uint ii = random.GetNextUint (size);
+    return random.NextDouble () < prob [ii] ? vertex [ii] : vertex [alias [ii]];
+  }
+
+  // Weight given to v at the time of Build (), 0.0 if absent.
+  double Weight (Vertex v) const {
+    return weight [v];
+  }
+
+  double Total () const {
+    return total;
+  }
+
+  uint Size () const {
+    return size;
+  }
+
+private:
+  static const uint kMaxSize = Board::kArea;
+
+  uint size;
+  double total;
+  NatMap <Vertex, double> weight;
+  Vertex vertex [kMaxSize];
+  double prob [kMaxSize];
+  uint alias [kMaxSize];
+};
+
+#endif
@@ -2,6 +2,8 @@
 // Copyright 2006 and onwards, Lukasz Lew
 //
 
+#include <thread>
+
 #include "benchmark.hpp"
 
 #include "fast_timer.hpp"
@@ -9,45 +11,68 @@
 
 namespace Benchmark {
 
-  uint move_count = 0;
-  Board empty_board;
-  Board board;
-  FastRandom random (123);
-  Gammas gammas;
-  Sampler sampler (board, gammas);
-
-  void DoPlayouts (uint playout_cnt, NatMap<Player, uint>* win_cnt) {
-    rep (ii, playout_cnt) {
-
-      board.Load (empty_board);
-      sampler.NewPlayout ();
-
-      while (!board.BothPlayerPass ()) {
-        Player pl = board.ActPlayer ();
-        Vertex v = sampler.SampleMove (random);
-        //Vertex v = board.RandomLightMove (pl, random);
-        board.PlayLegal (pl, v);
-        sampler.MovePlayed ();
-      }
+  // Everything a playout loop touches, one per thread.
+  class PlayoutRunner {
+  public:
+    PlayoutRunner (uint seed, uint stream)
+      : move_count (0), win_cnt (0), random (seed, stream), sampler (board, gammas),
+        seconds (0.0)
+    {
+    }
+
+    void DoPlayouts (uint playout_cnt) {
+      double begin = WallTime ();
+      rep (ii, playout_cnt) {
+
+        board.Load (empty_board);
+        sampler.NewPlayout ();
 
-      (*win_cnt) [board.PlayoutWinner ()] ++;
-      move_count += board.MoveCount();
+        while (!board.BothPlayerPass ()) {
+          Player pl = board.ActPlayer ();
+          Vertex v = sampler.SampleMove (random);
+          //Vertex v = board.RandomLightMove (pl, random);
+          board.PlayLegal (pl, v);
+          sampler.MovePlayed ();
+        }
+
+        win_cnt [board.PlayoutWinner ()] ++;
+        move_count += board.MoveCount();
+      }
+      seconds = WallTime () - begin;
     }
-  }
+
+    uint move_count;
+    NatMap <Player, uint> win_cnt;
+
+  private:
+    Board empty_board;
+    Board board;
+    FastRandom random;
+    Gammas gammas;
+    Sampler sampler;
+
+  public:
+    double seconds; // wall time of the last DoPlayouts
+  };
 
   string Run (uint playout_cnt) {
-    NatMap <Player, uint> win_cnt (0);
+    PlayoutRunner runner (123, 0);
     FastTimer fast_timer;
+    PerfCounters counters;
 
     fast_timer.Reset ();
     fast_timer.Start ();
+    counters.Start ();
     float seconds_begin = ProcessUserTime ();
     
-    DoPlayouts (playout_cnt, &win_cnt);
+    runner.DoPlayouts (playout_cnt);
 
     float seconds_end = ProcessUserTime ();
+    counters.Stop ();
     fast_timer.Stop ();
 
+    NatMap <Player, uint>& win_cnt = runner.win_cnt;
+    uint move_count = runner.move_count;
 
     float seconds_total = seconds_end - seconds_begin;
     float cc_per_playout = fast_timer.Ticks () / double (playout_cnt);
@@ -63,6 +88,100 @@ namespace Benchmark {
         << win_cnt [Player::Black ()] << "/" << win_cnt [Player::White ()]
         << " (black wins / white wins)" << endl
         << "AVG moves/playout = " << move_count / playouts_finished << endl;
+    if (counters.HasHardware ()) ret << counters.ToString (move_count, "move");
+
+    return ret.str();
+  }
+
+  namespace {
+    void RunnerThread (PlayoutRunner* runner, uint playout_cnt) {
+      runner->DoPlayouts (playout_cnt);
+    }
+
+    // Aggregate kpps of thread_cnt runners, each doing playout_cnt
+    // playouts at the same time.
+    double RunThreads (uint playout_cnt, uint thread_cnt,
+                       vector <PlayoutRunner*>& runners) {
+      rep (ii, thread_cnt) runners.push_back (new PlayoutRunner (123, ii));
+      vector <std::thread> threads;
+      double begin = WallTime ();
+      rep (ii, thread_cnt) {
+        threads.push_back (std::thread (RunnerThread, runners [ii], playout_cnt));
+      }
+      rep (ii, thread_cnt) threads [ii].join ();
+      double seconds = WallTime () - begin;
+      return double (playout_cnt) * thread_cnt / seconds / 1000.0;
+    }
+
+    void DeleteRunners (vector <PlayoutRunner*>& runners) {
+      rep (ii, runners.size ()) delete runners [ii];
+      runners.clear ();
+    }
+  }
+
+  string RunMt (uint playout_cnt, uint thread_cnt) {
+    vector <PlayoutRunner*> runners;
+    double single_kpps = RunThreads (playout_cnt, 1, runners);
+    DeleteRunners (runners);
+
+    double kpps = RunThreads (playout_cnt, thread_cnt, runners);
+
+    ostringstream ret;
+    ret << endl
+        << thread_cnt << " threads x " << playout_cnt << " playouts" << endl
+        << kpps << " kpps aggregate, " << single_kpps << " kpps single thread" << endl
+        << kpps / (thread_cnt * single_kpps) << " scaling efficiency" << endl;
+    rep (ii, thread_cnt) {
+      ret << "thread " << ii << ": "
+          << playout_cnt / runners [ii]->seconds / 1000.0 << " kpps" << endl;
+    }
+    DeleteRunners (runners);
+    return ret.str();
+  }
+
+  string SamplerRun (uint playout_cnt, const Gammas& gammas) {
+    const uint bucket_size = 10;
+    const uint bucket_cnt = 3 * Board::kArea / bucket_size + 1;
+    // Timing single moves needs a robust estimate of rdtsc overhead.
+    double overhead = FastTimer::MinOverhead ();
+
+    vector <FastTimer> timers [2];
+
+    rep (mode, 2) {
+      Board board;
+      Sampler sampler (board, gammas);
+      FastRandom random (123);
+      sampler.use_alias = (mode == 1);
+      timers [mode].resize (bucket_cnt);
+      rep (bucket, bucket_cnt) timers [mode] [bucket].overhead = overhead;
+
+      rep (ii, playout_cnt) {
+        board.Clear ();
+        sampler.NewPlayout ();
+
+        while (!board.BothPlayerPass ()) {
+          uint bucket = min (board.MoveCount () / bucket_size, bucket_cnt - 1);
+          Player pl = board.ActPlayer ();
+          timers [mode] [bucket].Start ();
+          Vertex v = sampler.SampleMove (random);
+          timers [mode] [bucket].Stop ();
+          board.PlayLegal (pl, v);
+          sampler.MovePlayed ();
+        }
+      }
+    }
+
+    ostringstream ret;
+    ret << endl << "moves    linear CC/move    alias CC/move" << endl;
+    rep (bucket, bucket_cnt) {
+      if (timers [0] [bucket].sample_cnt == 0) continue;
+      char buf [100];
+      sprintf (buf, "%3d-%-3d  %14.1f  %15.1f",
+               bucket * bucket_size, (bucket + 1) * bucket_size - 1,
+               timers [0] [bucket].Ticks (),
+               timers [1] [bucket].Ticks ());
+      ret << buf << endl;
+    }
 
     return ret.str();
   }
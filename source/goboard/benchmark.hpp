@@ -8,9 +8,18 @@
 #include <string>
 
 #include "board.hpp"
+#include "gammas.hpp"
 
 namespace Benchmark {
   string Run (uint playout_cnt);
+
+  // playout_cnt playouts in each of thread_cnt threads, every thread
+  // with its own board, sampler and random stream. Efficiency is
+  // relative to the same playouts in a single thread.
+  string RunMt (uint playout_cnt, uint thread_cnt);
+
+  // Cost of Sampler::SampleMove by move number, linear scan vs alias table.
+  string SamplerRun (uint playout_cnt, const Gammas& gammas);
 }
 
 #endif
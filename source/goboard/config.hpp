@@ -8,6 +8,11 @@
 // TODO this have to be renamed to max_board_size
 // TODO better use of CMake
 
-const uint board_size = 9;
+// BOARDSIZE can be set by the build, see bench/CMakeLists.txt.
+#ifndef BOARDSIZE
+#define BOARDSIZE 9
+#endif
+
+const uint board_size = BOARDSIZE;
 
 #endif
@@ -14,6 +14,7 @@
 
 #include "hash.cpp"
 #include "board.cpp"
+#include "gammas.cpp"
 
 #include "benchmark.cpp"
 #include "perft.cpp"
@@ -22,6 +22,8 @@
 #include "board.hpp"
 
 #include "gammas.hpp"
+#include "alias_table.hpp"
+#include "proximity.hpp"
 #include "sampler.hpp"
 
 #include "benchmark.hpp"
@@ -0,0 +1,194 @@
+//
+// Copyright 2006 and onwards, Lukasz Lew
+//
+
+#include <cstdio>
+#include <cstring>
+
+#ifndef _MSC_VER
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "gammas.hpp"
+
+// Binary gamma file layout (native endianness):
+//   GammasFileHeader (64 bytes)
+//   Gammas::Tab - double [Hash3x3::kBound] [Player::kBound]
+
+namespace {
+  const char kGammasMagic [8] = { 'E', 'G', 'O', 'G', 'A', 'M', 'M', 'A' };
+  const uint kGammasVersion = 1;
+
+  struct GammasFileHeader {
+    char   magic [8];
+    uint   version;
+    uint   hash_count;
+    uint   player_count;
+    uint   value_size;
+    uint64 checksum;     // see Checksum
+    char   padding [32];
+  };
+
+  // FNV-1a on 64 bit words, size has to be divisible by 8.
+  uint64 Checksum (const void* data, size_t size) {
+    const uint64* p = static_cast <const uint64*> (data);
+    uint64 hash = 14695981039346656037ULL;
+    rep (ii, size / sizeof (uint64)) {
+      hash ^= p [ii];
+      hash *= 1099511628211ULL;
+    }
+    return hash;
+  }
+
+  GammasFileHeader ExpectedHeader () {
+    GammasFileHeader header;
+    memset (&header, 0, sizeof (header));
+    memcpy (header.magic, kGammasMagic, sizeof (kGammasMagic));
+    header.version      = kGammasVersion;
+    header.hash_count   = Hash3x3::kBound;
+    header.player_count = Player::kBound;
+    header.value_size   = sizeof (double);
+    return header;
+  }
+
+  bool HeaderOk (const GammasFileHeader& header) {
+    GammasFileHeader expected = ExpectedHeader ();
+    return
+      memcmp (header.magic, expected.magic, sizeof (header.magic)) == 0 &&
+      header.version      == expected.version &&
+      header.hash_count   == expected.hash_count &&
+      header.player_count == expected.player_count &&
+      header.value_size   == expected.value_size;
+  }
+}
+
+
+bool Gammas::IsBinaryFile (const string& file_name) {
+  FILE* f = fopen (file_name.c_str(), "rb");
+  if (f == NULL) return false;
+  char magic [sizeof (kGammasMagic)];
+  bool ok = fread (magic, sizeof (magic), 1, f) == 1 &&
+    memcmp (magic, kGammasMagic, sizeof (magic)) == 0;
+  fclose (f);
+  return ok;
+}
+
+
+bool Gammas::WriteBinary (const string& file_name) const {
+  GammasFileHeader header = ExpectedHeader ();
+  header.checksum = Checksum (table, sizeof (Tab));
+
+  FILE* f = fopen (file_name.c_str(), "wb");
+  if (f == NULL) return false;
+  bool ok =
+    fwrite (&header, sizeof (header), 1, f) == 1 &&
+    fwrite (table, sizeof (Tab), 1, f) == 1;
+  return fclose (f) == 0 && ok;
+}
+
+
+#ifndef _MSC_VER
+
+bool Gammas::ReadBinary (const string& file_name) {
+  const size_t size = sizeof (GammasFileHeader) + sizeof (Tab);
+
+  int fd = open (file_name.c_str(), O_RDONLY);
+  if (fd < 0) return false;
+  struct stat st;
+  if (fstat (fd, &st) != 0 || size_t (st.st_size) != size) {
+    close (fd);
+    return false;
+  }
+  void* data = mmap (NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+  close (fd);
+  if (data == MAP_FAILED) return false;
+
+  const GammasFileHeader* header = static_cast <const GammasFileHeader*> (data);
+  const Tab* file_table =
+    reinterpret_cast <const Tab*> (static_cast <const char*> (data) + sizeof (*header));
+
+  if (!HeaderOk (*header) ||
+      header->checksum != Checksum (file_table, sizeof (Tab))) {
+    munmap (data, size);
+    return false;
+  }
+
+  Unmap ();
+  mapped = data;
+  mapped_size = size;
+  table = file_table;
+  BuildPolicy ();
+  return true;
+}
+
+
+void Gammas::Unmap () {
+  table = gammas;
+  if (mapped == NULL) return;
+  munmap (mapped, mapped_size);
+  mapped = NULL;
+  mapped_size = 0;
+}
+
+#else
+
+// No mmap, the file is copied into the owned table.
+bool Gammas::ReadBinary (const string& file_name) {
+  FILE* f = fopen (file_name.c_str(), "rb");
+  if (f == NULL) return false;
+  GammasFileHeader header;
+  bool ok = fread (&header, sizeof (header), 1, f) == 1 && HeaderOk (header);
+  Tab* tmp = new Tab;
+  ok = ok && fread (tmp, sizeof (Tab), 1, f) == 1;
+  ok = ok && fgetc (f) == EOF;
+  ok = ok && header.checksum == Checksum (tmp, sizeof (Tab));
+  fclose (f);
+  if (ok) {
+    memcpy (gammas, tmp, sizeof (Tab));
+    BuildPolicy ();
+  }
+  delete tmp;
+  return ok;
+}
+
+
+void Gammas::Unmap () {
+  table = gammas;
+}
+
+#endif
+
+
+void Gammas::SetPolicy (double temperature, double prune_fraction) {
+  policy_temperature = max (temperature, 0.05);
+  policy_prune_fraction = prune_fraction;
+  BuildPolicy ();
+}
+
+
+void Gammas::BuildPolicy () {
+  if (policy_temperature == 1.0 && policy_prune_fraction <= 0.0) {
+    policy_table = table;
+    return;
+  }
+
+  double max_gamma = 0.0;
+  ForEachNat (Hash3x3, hash) {
+    ForEachNat (Player, pl) max_gamma = max (max_gamma, (*table) [hash] [pl]);
+  }
+
+  if (policy == NULL) policy = new Tab;
+  double threshold = policy_prune_fraction * max_gamma;
+  double exponent = 1.0 / policy_temperature;
+  ForEachNat (Hash3x3, hash) {
+    ForEachNat (Player, pl) {
+      double gamma = (*table) [hash] [pl];
+      (*policy) [hash] [pl] =
+        gamma == 0.0 || gamma < threshold ? 0.0 : pow (gamma, exponent);
+    }
+  }
+  policy_table = policy;
+}
@@ -9,25 +9,36 @@ const double GammaskAccurancy = 1.0e-10;
 
 class Gammas {
 public:
-  Gammas () {
+  typedef NatMap<Hash3x3, NatMap<Player, double> > Tab;
+
+  Gammas ()
+    : mapped (NULL), mapped_size (0), policy (NULL), policy_table (NULL),
+      policy_temperature (1.0), policy_prune_fraction (0.0)
+  {
     gammas = new Tab;
+    table = gammas;
     ResetToUniform ();
   }
 
   ~Gammas () {
+    Unmap ();
     delete gammas;
+    delete policy;
   }
 
   void ZeroAllGammas () {
+    Unmap ();
     ForEachNat (Hash3x3, hash) {
       ForEachNat (Player, pl) {
         (*gammas) [hash] [pl] = 0.0;
       }
     }
+    BuildPolicy ();
   }
 
 
   void ResetToUniform () {
+    Unmap ();
     ForEachNat (Hash3x3, hash) {
       ForEachNat (Player, pl) {
         (*gammas) [hash] [pl] = 
@@ -36,6 +47,7 @@ public:
           : 0.0;
       }
     }
+    BuildPolicy ();
   }
 
 
@@ -77,18 +89,44 @@ public:
       ResetToUniform ();
       return false;
     }
+    BuildPolicy ();
     return true;
   }
 
 
   double Get (Hash3x3 hash, Player pl) const {
-    return (*gammas) [hash] [pl];
+    return (*table) [hash] [pl];
   }
 
-private:
+  // Gammas of the playout policy: gamma ^ (1/temperature), and zero for
+  // gammas below prune_fraction * (the largest gamma). The table is built
+  // when the policy or the gammas change, so samplers sharing these
+  // gammas only read it. Samplers must RefreshPolicy after a change.
+  void SetPolicy (double temperature, double prune_fraction);
+  double PolicyTemperature () const { return policy_temperature; }
+  double PolicyPruneFraction () const { return policy_prune_fraction; }
+  const Tab& PolicyTable () const { return *policy_table; }
+
+  // Binary format holds the table with all symmetries already expanded.
+  // It is mmap'ed read-only, so engines loading the same file share it.
+  // See gammas.cpp for the layout.
+  static bool IsBinaryFile (const string& file_name);
+  bool ReadBinary (const string& file_name);
+  bool WriteBinary (const string& file_name) const;
 
-  typedef NatMap<Hash3x3, NatMap<Player, double> > Tab;
-  Tab* gammas;
+private:
+  void Unmap ();
+  void BuildPolicy ();  // after every change of table
+
+  Tab* gammas;       // Owned, modified by Read and ResetToUniform.
+  const Tab* table;  // Either gammas or a table in a mapped file.
+  void* mapped;
+  size_t mapped_size;
+
+  Tab* policy;               // Owned, allocated for a non-identity policy.
+  const Tab* policy_table;   // Either table or policy.
+  double policy_temperature;
+  double policy_prune_fraction;
 };
 
 #endif
@@ -16,11 +16,7 @@ uint Hash::Lock() const {
 }
 
 void Hash::Randomize (FastRandom& fr) { 
-  hash =
-    (uint64 (fr.GetNextUint ()) << (0*16)) ^
-    (uint64 (fr.GetNextUint ()) << (1*16)) ^ 
-    (uint64 (fr.GetNextUint ()) << (2*16)) ^ 
-    (uint64 (fr.GetNextUint ()) << (3*16));
+  hash = (uint64 (fr.GetNextUint ()) << 32) | fr.GetNextUint ();
 }
 
 void Hash::SetZero () {
@@ -2,56 +2,188 @@
 // Copyright 2023 and onwards, Folkert van Heusden
 //
 
+#include <atomic>
+#include <thread>
+
 #include "board.hpp"
 #include "perft.hpp"
 
-namespace Perft {
-	uint64_t perft(const Board & board, const Player & p, const int depth, const int pass) {
-		if (depth == 0)
-			return 1;
-
-		uint64_t count = 0;
-
-		int dim = board.Size();
-
-		Player new_player = p.Other();
-
-		int new_depth = depth - 1;
-
-		for(int y=0; y<dim; y++) {
-			for(int x=0; x<dim; x++)  {
-				Move m(p, Vertex::OfCoords(x, y));
-
-				if (board.IsLegal(m) == false)
-					continue;
-
-				Board copy;
-				copy.Load(board);
+// Counts leaves of the move tree: every IsLegal move and a pass
+// (unless the previous move was a pass too, which ends the game).
+// Superko is ignored on purpose - it would make the count depend on
+// the move history and the transposition table key on the position
+// only.
 
-				copy.PlayLegal(m);
-
-				if (new_depth)
-					count += perft(copy, new_player, new_depth, 0);
-				else
-					count++;
-			}
-		}
-
-		if (pass == 0)
-			count += perft(board, new_player, new_depth, pass + 1);
-
-		return count;
-	}
-
-	string Run (uint depth) {
-		Board board;
-
-		int dim = board.Size();
-
-		for (int i=1; i<=depth; i++) {
-			printf("%d: %lu\n", i, perft(board, Player::Black(), i, 0));
-		}
-
-		return "";
-	}
+namespace Perft {
+  namespace {
+
+    // One per thread, so the table needs no locking.
+    class Searcher {
+    public:
+      explicit Searcher (uint max_depth)
+        : probe_cnt (0),
+          hit_cnt (0),
+          boards (new RawBoard [max_depth + 1]),
+          table (new Entry [kTableSize])
+      {
+        rep (ii, kTableSize) {
+          table [ii].key = 0;
+          table [ii].count = 0;
+          table [ii].depth = 0;
+        }
+      }
+
+      ~Searcher () {
+        delete [] boards;
+        delete [] table;
+      }
+
+      uint64 Count (const RawBoard& board, Player pl, uint depth, bool after_pass) {
+        ASSERT (depth > 0);
+        if (depth == 1) return LegalMoveCount (board, pl) + !after_pass;
+
+        uint64 key = Key (board, pl, after_pass);
+        Entry& entry = table [key & (kTableSize - 1)];
+        probe_cnt += 1;
+        if (entry.key == key && entry.depth == depth) {
+          hit_cnt += 1;
+          return entry.count;
+        }
+
+        RawBoard& child = boards [depth];
+        uint64 count = 0;
+        rep (ii, board.EmptyVertexCount ()) {
+          Vertex v = board.EmptyVertex (ii);
+          if (!board.IsLegal (pl, v)) continue;
+          child.Load (board);
+          child.PlayLegal (pl, v);
+          count += Count (child, pl.Other (), depth - 1, false);
+        }
+        if (!after_pass) count += Count (board, pl.Other (), depth - 1, true);
+
+        entry.key = key;
+        entry.count = count;
+        entry.depth = depth;
+        return count;
+      }
+
+      uint64 probe_cnt;
+      uint64 hit_cnt;
+
+    private:
+      static const uint kTableSize = 1 << 19;
+
+      struct Entry {
+        uint64 key;
+        uint64 count;
+        uint depth;
+      };
+
+      static uint LegalMoveCount (const RawBoard& board, Player pl) {
+        uint count = 0;
+        rep (ii, board.EmptyVertexCount ()) {
+          count += board.IsLegal (pl, board.EmptyVertex (ii));
+        }
+        return count;
+      }
+
+      // Stones, ko vertex, player to move and pass state.
+      static uint64 Key (const RawBoard& board, Player pl, bool after_pass) {
+        Hash hash = board.PositionalHash ();
+        uint64 key = (uint64 (hash.Lock ()) << 32) | hash.Index ();
+        uint64 state =
+          (uint64 (board.KoVertex ().GetRaw ()) << 2) |
+          (pl.GetRaw () << 1) |
+          uint64 (after_pass);
+        return key ^ ((state + 1) * 0x9E3779B97F4A7C15ULL);
+      }
+
+      RawBoard* boards;    // boards [d] holds children at remaining depth d
+      Entry* table;
+    };
+
+
+    // A root move (or pass) whose subtree is counted by one of the workers.
+    struct RootJob {
+      RawBoard* board;
+      Player player;
+      bool after_pass;
+      uint64 count;
+    };
+
+    struct Split {
+      vector <RootJob> jobs;
+      uint depth;
+      std::atomic <uint> next_job;
+      std::atomic <uint64> probe_cnt;
+      std::atomic <uint64> hit_cnt;
+    };
+
+    void Worker (Split* split) {
+      Searcher searcher (split->depth);
+      while (true) {
+        uint ii = split->next_job.fetch_add (1);
+        if (ii >= split->jobs.size ()) break;
+        RootJob& job = split->jobs [ii];
+        job.count =
+          split->depth == 1 ? 1 :
+          searcher.Count (*job.board, job.player, split->depth - 1, job.after_pass);
+      }
+      split->probe_cnt += searcher.probe_cnt;
+      split->hit_cnt += searcher.hit_cnt;
+    }
+
+    // Leaf count of the empty board at given depth, root moves are
+    // distributed between thread_cnt workers.
+    uint64 Perft (uint depth, uint thread_cnt, double* hit_rate) {
+      RawBoard root;
+      Player pl = Player::Black ();
+      Split split;
+      split.depth = depth;
+      split.next_job = 0;
+      split.probe_cnt = 0;
+      split.hit_cnt = 0;
+
+      rep (ii, root.EmptyVertexCount ()) {
+        Vertex v = root.EmptyVertex (ii);
+        if (!root.IsLegal (pl, v)) continue;
+        RootJob job = { new RawBoard, pl.Other (), false, 0 };
+        job.board->Load (root);
+        job.board->PlayLegal (pl, v);
+        split.jobs.push_back (job);
+      }
+      RootJob pass_job = { new RawBoard, pl.Other (), true, 0 };
+      pass_job.board->Load (root);
+      split.jobs.push_back (pass_job);
+
+      vector <std::thread> threads;
+      rep (ii, thread_cnt) threads.push_back (std::thread (Worker, &split));
+      rep (ii, thread_cnt) threads [ii].join ();
+
+      uint64 count = 0;
+      rep (ii, split.jobs.size ()) {
+        count += split.jobs [ii].count;
+        delete split.jobs [ii].board;
+      }
+      *hit_rate = double (split.hit_cnt) / max (uint64 (split.probe_cnt), uint64 (1));
+      return count;
+    }
+  }
+
+  string Run (uint depth, uint thread_cnt) {
+    ostringstream out;
+    reps (d, 1, depth + 1) {
+      double hit_rate;
+      double begin = WallTime ();
+      uint64 count = Perft (d, thread_cnt, &hit_rate);
+      double seconds = WallTime () - begin;
+      char buf [200];
+      sprintf (buf, "%u: %lu  (%.3f s, %.0f kleaves/s, tt hits %.1f%%)",
+               d, (unsigned long) count, seconds,
+               count / max (seconds, 1e-9) / 1000.0, 100.0 * hit_rate);
+      out << buf;
+      if (d < int (depth)) out << endl;
+    }
+    return out.str ();
+  }
 }
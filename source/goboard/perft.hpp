@@ -10,7 +10,9 @@
 #include "board.hpp"
 
 namespace Perft {
-  string Run (uint depth);
+  // Leaf counts of the move tree from the empty board for depths
+  // 1..depth, root moves are split between thread_cnt threads.
+  string Run (uint depth, uint thread_cnt);
 }
 
 #endif
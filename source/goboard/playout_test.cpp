@@ -89,17 +89,17 @@ void PlayoutTest (bool print_moves) {
     << endl;
 
   if (board_size == 9) {
-    CHECK (win_cnt [Player::Black()] == 4436);
-    CHECK (win_cnt [Player::White()] == 5564);
+    CHECK (win_cnt [Player::Black()] == 4443);
+    CHECK (win_cnt [Player::White()] == 5557);
     CHECK (move_count  == move_count2);
-    CHECK (move_count2 == 1109454);
-    CHECK (hash_changed_count == 3702383);
+    CHECK (move_count2 == 1109256);
+    CHECK (hash_changed_count == 3699033);
   } else if (board_size == 19) {
     CHECK (win_cnt [Player::Black()] == 476);
     CHECK (win_cnt [Player::White()] == 524);
     CHECK (move_count  == move_count2);
-    CHECK (move_count2 == 454567);
-    CHECK (hash_changed_count == 1689259);
+    CHECK (move_count2 == 453841);
+    CHECK (hash_changed_count == 1688589);
   } else {
     CHECK (false);
   }
@@ -164,11 +164,11 @@ void SamplerPlayoutTest (bool print_moves) {
 
 
   if (board_size == 9) {
-    CHECK (win_cnt [Player::Black()] == 4587);
-    CHECK (win_cnt [Player::White()] == 5413);
+    CHECK (win_cnt [Player::Black()] == 4633);
+    CHECK (win_cnt [Player::White()] == 5367);
     CHECK (move_count  == move_count2);
-    CHECK (move_count2 == 1150865 );
-    CHECK (hash_changed_count == 3798115);
+    CHECK (move_count2 == 1149149 );
+    CHECK (hash_changed_count == 3795268);
   } else if (board_size == 19) {
     CHECK(false); // TODO too lazy to update these.
     CHECK (win_cnt [Player::Black()] == 452);
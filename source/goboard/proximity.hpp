@@ -0,0 +1,86 @@
+#ifndef _PROXIMITY_HPP
+#define _PROXIMITY_HPP
+
+#include "board.hpp"
+
+// For each on-board vertex a precomputed list of on-board vertices
+// within kMaxRadius lines, sorted by radius. Each entry carries its
+// proximity class - an index into Sampler::proximity_bonus.
+// Radius 1 neighbours come first in ForEachNat (Dir) order.
+
+class ProximityTable {
+public:
+  static const uint kMaxRadius = 3;
+  static const uint kClassCount = kMaxRadius * (kMaxRadius + 3) / 2;
+  static const uint kMaxNbrCount = (2*kMaxRadius + 1) * (2*kMaxRadius + 1) - 1;
+
+  struct Nbr {
+    Vertex v;
+    uint proximity_class;
+  };
+
+  static const ProximityTable& Get () {
+    static const ProximityTable table;
+    return table;
+  }
+
+  // Number of entries of Nbrs (v) within given radius.
+  uint Count (Vertex v, uint radius) const {
+    ASSERT (radius <= kMaxRadius);
+    return entry [v].count [radius];
+  }
+
+  const Nbr* Nbrs (Vertex v) const {
+    return entry [v].nbrs;
+  }
+
+  // Classes: 0 - 4-neighbour, 1 - diagonal, 2,3,4 - radius 2, ...
+  static uint ProximityClass (int dr, int dc) {
+    uint a = max (abs (dr), abs (dc));
+    uint b = min (abs (dr), abs (dc));
+    ASSERT (a >= 1 && a <= kMaxRadius);
+    return a * (a+1) / 2 - 1 + b;
+  }
+
+private:
+  ProximityTable () {
+    ForEachNat (Vertex, v) {
+      Entry& e = entry [v];
+      rep (r, kMaxRadius + 1) e.count [r] = 0;
+      if (!v.IsOnBoard ()) continue;
+      uint n = 0;
+
+      ForEachNat (Dir, d) {
+        Vertex nbr = v.Nbr (d);
+        if (!nbr.IsOnBoard ()) continue;
+        e.nbrs [n].v = nbr;
+        e.nbrs [n].proximity_class = d.Proximity ();
+        n += 1;
+      }
+      e.count [1] = n;
+
+      reps (r, 2, kMaxRadius + 1) {
+        reps (dr, -r, r + 1) {
+          reps (dc, -r, r + 1) {
+            if (max (abs (dr), abs (dc)) != r) continue;
+            Vertex nbr = Vertex::OfCoords (v.GetRow () + dr, v.GetColumn () + dc);
+            if (nbr == Vertex::Invalid ()) continue;
+            e.nbrs [n].v = nbr;
+            e.nbrs [n].proximity_class = ProximityClass (dr, dc);
+            n += 1;
+          }
+        }
+        e.count [r] = n;
+      }
+    }
+  }
+
+  struct Entry {
+    Nbr nbrs [kMaxNbrCount];
+    uint count [kMaxRadius + 1];
+  };
+
+  NatMap <Vertex, Entry> entry;
+};
+
+#endif
@@ -3,28 +3,93 @@
 
 #include <random>
 #include "test.hpp"
+#include "alias_table.hpp"
+#include "proximity.hpp"
+
+// SamplerStats are counted only with EGO_SAMPLER_STATS defined
+// (cmake -DEGO_SAMPLER_STATS=ON).
+#ifdef EGO_SAMPLER_STATS
+const bool kSamplerStats = true;
+#else
+const bool kSamplerStats = false;
+#endif
+
+// What Sampler::SampleMove does, counted since the last Reset ().
+struct SamplerStats {
+  SamplerStats () {
+    Reset ();
+  }
+
+  void Reset () {
+    draws = 0;
+    local_draws = 0;
+    non_local_draws = 0;
+    passes = 0;
+    scans = 0;
+    scan_steps = 0;
+    underflows = 0;
+  }
+
+  string ToString () const {
+    double n = max (draws, uint64 (1));
+    ostringstream out;
+    out << "draws "      << draws << endl
+        << "local "      << 100.0 * local_draws / n << "%" << endl
+        << "non_local "  << 100.0 * non_local_draws / n << "%" << endl
+        << "pass "       << 100.0 * passes / n << "%" << endl
+        << "avg_scan "   << double (scan_steps) / max (scans, uint64 (1)) << endl
+        << "underflows " << underflows << endl;
+    return out.str ();
+  }
+
+  uint64 draws;
+  uint64 local_draws;
+  uint64 non_local_draws;
+  uint64 passes;
+  uint64 scans;      // SampleNonLocalMove calls
+  uint64 scan_steps; // empty vertices visited by SampleNonLocalMove
+  uint64 underflows; // negative gamma sums and overran scans
+};
 
 
 struct Sampler {
   explicit Sampler (const Board& board, const Gammas& gammas) :
     board (board),
-    gammas (gammas)
+    gammas (gammas),
+    proximity (ProximityTable::Get ())
   {
     ForEachNat (Player, pl) {
       ForEachNat (Vertex, v) {
         act_gamma [v] [pl] = 0.0;
+        alias_is_patched [v] [pl] = false;
       }
       act_gamma_sum [pl] = 0.0;
+      alias_excess_sum [pl] = 0.0;
     }
+    rep (ii, ProximityTable::kClassCount) proximity_bonus [ii] = 1.0;
     proximity_bonus [0] = 10.0;
     proximity_bonus [1] = 10.0;
+    local_radius = 1;
+    local_valid = false;
+    use_alias = false;
+    alias_rebuild_fraction = 0.5;
+    RefreshPolicy ();
   }
 
 
   ~Sampler () {
   }
 
+  // Must be called after gammas are reloaded (the old table may be
+  // unmapped) or their policy changes (Gammas::SetPolicy).
+  void RefreshPolicy () {
+    policy_table = &gammas.PolicyTable ();
+    use_candidates = gammas.PolicyPruneFraction () > 0.0;
+  }
+
   void NewPlayout () {
+    RefreshPolicy ();
+
     // Prepare act_gamma and act_gamma_sum
     ForEachNat (Player, pl) {
       // TODO memcpy
@@ -35,7 +100,7 @@ struct Sampler {
 
       rep (ii, board.EmptyVertexCount()) {
         Vertex v = board.EmptyVertex (ii);
-        act_gamma [v] [pl] = gammas.Get (board.Hash3x3At (v), pl);
+        act_gamma [v] [pl] = PolicyGamma (v, pl);
         act_gamma_sum [pl] += act_gamma [v] [pl];
       }
     }
@@ -45,6 +110,21 @@ struct Sampler {
     act_gamma_sum [act_pl] -= act_gamma [ko_v] [act_pl];
     act_gamma [ko_v] [act_pl] = 0.0;
 
+    if (use_alias) {
+      ForEachNat (Player, pl) RebuildAlias (pl);
+    }
+
+    if (use_candidates) {
+      ForEachNat (Player, pl) {
+        candidates [pl].Clear ();
+        rep (ii, board.EmptyVertexCount()) {
+          Vertex v = board.EmptyVertex (ii);
+          if (act_gamma [v] [pl] > 0.0) AddCandidate (v, pl);
+        }
+      }
+    }
+
+    local_valid = false;
     CheckConsistency ();
   }
 
@@ -54,24 +134,19 @@ struct Sampler {
     Vertex last_v  = board.LastVertex ();
     // Restore gamma after ko_ban lifted
     ASSERT (act_gamma [ko_v] [last_pl] == 0.0);
-    act_gamma [ko_v] [last_pl] = gammas.Get (board.Hash3x3At (ko_v), last_pl); 
-    act_gamma_sum [last_pl] += act_gamma [ko_v] [last_pl];
+    SetActGamma (ko_v, last_pl, PolicyGamma (ko_v, last_pl));
 
     ForEachNat (Player, pl) {
       // One new occupied intersection.
       ASSERT (board.ColorAt(last_v) != Color::Empty());
-      act_gamma_sum [pl] -= act_gamma [last_v] [pl];
-      act_gamma [last_v] [pl] = 0.0;
+      SetActGamma (last_v, pl, 0.0);
 
       // All new gammas.
       uint n = board.Hash3x3ChangedCount ();
       rep (ii, n) {
         Vertex v = board.Hash3x3Changed (ii);
         ASSERT (board.ColorAt(v) == Color::Empty());
-
-        act_gamma_sum [pl] -= act_gamma [v] [pl];
-        act_gamma [v] [pl] = gammas.Get (board.Hash3x3At (v), pl);
-        act_gamma_sum [pl] += act_gamma [v] [pl];
+        SetActGamma (v, pl, PolicyGamma (v, pl));
       }
     }
 
@@ -79,9 +154,9 @@ struct Sampler {
     Player act_pl  = board.ActPlayer();
     ko_v = board.KoVertex();
     ASSERT (board.ColorAt(ko_v) == Color::Empty() || ko_v == Vertex::Any ());
-    act_gamma_sum [act_pl] -= act_gamma [ko_v] [act_pl];
-    act_gamma [ko_v] [act_pl] = 0.0;
+    SetActGamma (ko_v, act_pl, 0.0);
 
+    local_valid = false;
     CheckConsistency ();
   }
 
@@ -101,65 +176,87 @@ struct Sampler {
   
   Vertex SampleMove (FastRandom& random) {
     Player pl = board.ActPlayer ();
+    if (kSamplerStats) stats.draws += 1;
 
     if (act_gamma_sum [pl] < GammaskAccurancy) {
       // TODO assert no_more_legal_moves
-      return Vertex::Pass ();
+      if (kSamplerStats && act_gamma_sum [pl] < -GammaskAccurancy) {
+        stats.underflows += 1;
+      }
+      // Pruned policy must not end the playout while moves are left.
+      Vertex v = use_candidates
+        ? board.RandomLightMove (pl, random)
+        : Vertex::Pass ();
+      if (kSamplerStats && v == Vertex::Pass ()) stats.passes += 1;
+      return v;
     }
     
     CalculateLocalGammas ();
 
     // Draw sample.
     double sample = random.NextDouble (total_non_local_gamma + total_local_gamma);
+    Vertex v;
 
     // Local move ?
     if (sample < total_local_gamma) {
-      return SampleLocalMove (sample);
+      if (kSamplerStats) stats.local_draws += 1;
+      v = SampleLocalMove (sample);
+    } else if (use_alias) {
+      if (kSamplerStats) stats.non_local_draws += 1;
+      v = SampleNonLocalMoveAlias (random);
     } else {
+      if (kSamplerStats) stats.non_local_draws += 1;
       sample -= total_local_gamma;
-      return SampleNonLocalMove (sample);
+      v = SampleNonLocalMove (sample);
     }
+
+    if (kSamplerStats && v == Vertex::Pass ()) stats.passes += 1;
+    return v;
   }
 
 
+  // Must be called after local_radius or proximity_bonus change.
+  void InvalidateLocalGammas () {
+    local_valid = false;
+  }
+
+  // Splits act_gamma into local (near the last move) and non-local part.
+  // The local set is the neighbourhood of the last move, so each move
+  // replaces it rather than updating it: MovePlayed only invalidates
+  // the split and the first draw rebuilds it from the proximity table,
+  // at most kMaxNbrCount vertices. Cached until the next NewPlayout or
+  // MovePlayed.
   void CalculateLocalGammas () {
     Player pl = board.ActPlayer ();
+    if (local_valid && local_pl == pl) return;
+    local_valid = true;
+    local_pl = pl;
+
     is_in_local.Clear ();
     local_vertices.Clear ();
     total_non_local_gamma = act_gamma_sum [pl];
     total_local_gamma = 0.0;
 
     Vertex last_v = board.LastVertex ();
-
-    if (board.ColorAt (last_v) != Color::OffBoard ()) {
-      // TODO optimize this
-      ForEachNat (Dir, d) { // TODO unroll loop
-        Vertex nbr = last_v.Nbr (d);
-        EnsureLocal (nbr);
-        local_gamma [nbr] *= proximity_bonus [d.Proximity()];
-      }
-    }
-
-    rep (ii, local_vertices.Size ()) {
-      Vertex local_v = local_vertices [ii];
-      total_local_gamma += local_gamma [local_v];
+    if (board.ColorAt (last_v) == Color::OffBoard ()) return;
+
+    uint radius = min (local_radius, uint (ProximityTable::kMaxRadius));
+    uint n = proximity.Count (last_v, radius);
+    const ProximityTable::Nbr* nbrs = proximity.Nbrs (last_v);
+    rep (ii, n) {
+      Vertex nbr = nbrs [ii].v;
+      double gamma = act_gamma [nbr] [pl];
+      is_in_local.Mark (nbr);
+      local_vertices.Push (nbr);
+      local_gamma [nbr] = gamma * proximity_bonus [nbrs [ii].proximity_class];
+      total_non_local_gamma -= gamma;
+      total_local_gamma += local_gamma [nbr];
     }
 
     CheckLocalSumCorrect ();
   }
 
 
-  void EnsureLocal (Vertex v) {
-    if (!is_in_local.IsMarked (v)) {
-      Player pl = board.ActPlayer ();
-      is_in_local.Mark (v);
-      local_vertices.Push (v);
-      local_gamma [v] = act_gamma [v] [pl];
-      total_non_local_gamma -= act_gamma [v] [pl];
-    }
-  }
-
-
   Vertex SampleLocalMove (double sample) {
     double local_gamma_sum = 0.0;
     rep (ii, local_vertices.Size ()) {
@@ -177,21 +274,71 @@ struct Sampler {
     ASSERT (sample < total_non_local_gamma || total_non_local_gamma == 0.0);
     Player pl = board.ActPlayer();
     double sum = 0.0;
-    rep (ii, board.EmptyVertexCount()) {
-      Vertex v = board.EmptyVertex (ii);
+    if (kSamplerStats) stats.scans += 1;
+    // With pruning only the (shorter) candidate list has non-zero gammas.
+    uint n = use_candidates ? candidates [pl].Size () : board.EmptyVertexCount();
+    rep (ii, n) {
+      Vertex v = use_candidates ? candidates [pl] [ii] : board.EmptyVertex (ii);
       if (is_in_local.IsMarked (v)) continue;
       sum += act_gamma [v] [pl];
       if (sum > sample) {
         ASSERT (total_non_local_gamma > 0.0);
         ASSERT (act_gamma [v] [pl] > 0.0);
+        if (kSamplerStats) stats.scan_steps += ii + 1;
         return v;
       }
     }
+    if (kSamplerStats) {
+      stats.scan_steps += n;
+      if (total_non_local_gamma >= GammaskAccurancy) stats.underflows += 1;
+    }
     return Vertex::Pass();
   }
 
-  void SampleMany (uint nn, NatMap <Vertex,double>& count) {
-    FastRandom fr;
+  // Same distribution as SampleNonLocalMove but O(1) on average.
+  // Draws from the alias table built with old gammas and corrects for
+  // the changes since then by rejection and by a small list of excesses.
+  Vertex SampleNonLocalMoveAlias (FastRandom& random) {
+    Player pl = board.ActPlayer();
+    if (total_non_local_gamma < GammaskAccurancy) return Vertex::Pass();
+
+    const AliasTable& table = alias [pl];
+    if (alias_patched [pl].Size () >
+        alias_rebuild_fraction * max (table.Size (), 1u)) {
+      RebuildAlias (pl);
+    }
+
+    while (true) {
+      double table_total = table.Total ();
+      double sample = random.NextDouble (table_total + alias_excess_sum [pl]);
+      Vertex v = Vertex::Pass ();
+
+      if (sample < table_total) {
+        v = table.Sample (random);
+        double table_gamma = table.Weight (v);
+        if (act_gamma [v] [pl] < table_gamma &&
+            random.NextDouble (table_gamma) >= act_gamma [v] [pl]) continue;
+      } else {
+        sample -= table_total;
+        double sum = 0.0;
+        rep (ii, alias_patched [pl].Size ()) {
+          Vertex patched_v = alias_patched [pl] [ii];
+          sum += AliasExcess (patched_v, pl);
+          if (sum > sample) {
+            v = patched_v;
+            break;
+          }
+        }
+        if (v == Vertex::Pass ()) continue; // rounding errors
+      }
+
+      if (is_in_local.IsMarked (v)) continue;
+      ASSERT (act_gamma [v] [pl] > 0.0);
+      return v;
+    }
+  }
+
+  void SampleMany (uint nn, NatMap <Vertex,double>& count, FastRandom& fr) {
     count.SetAll (0.0);
     ForEachNat (Vertex, v) {
       if (v.IsOnBoard () && board.IsLegal (board.ActPlayer(), v)) count [v] = 0.0;
@@ -224,6 +371,73 @@ struct Sampler {
 
 private:
 
+  double PolicyGamma (Vertex v, Player pl) const {
+    return (*policy_table) [board.Hash3x3At (v)] [pl];
+  }
+
+
+  void SetActGamma (Vertex v, Player pl, double gamma) {
+    if (use_candidates) {
+      bool was_candidate = act_gamma [v] [pl] > 0.0;
+      if (!was_candidate && gamma > 0.0) AddCandidate (v, pl);
+      if (was_candidate && gamma == 0.0) RemoveCandidate (v, pl);
+    }
+
+    if (use_alias) {
+      alias_excess_sum [pl] -= AliasExcess (v, pl);
+      if (!alias_is_patched [v] [pl] && gamma != alias [pl].Weight (v)) {
+        alias_is_patched [v] [pl] = true;
+        alias_patched [pl].Push (v);
+      }
+    }
+
+    act_gamma_sum [pl] -= act_gamma [v] [pl];
+    act_gamma [v] [pl] = gamma;
+    act_gamma_sum [pl] += act_gamma [v] [pl];
+
+    if (use_alias) {
+      alias_excess_sum [pl] += AliasExcess (v, pl);
+    }
+  }
+
+
+  void AddCandidate (Vertex v, Player pl) {
+    candidate_pos [v] [pl] = candidates [pl].Size ();
+    candidates [pl].Push (v);
+  }
+
+
+  void RemoveCandidate (Vertex v, Player pl) {
+    uint pos = candidate_pos [v] [pl];
+    ASSERT (candidates [pl] [pos] == v);
+    Vertex last = candidates [pl].PopTop ();
+    candidates [pl] [pos] = last;
+    candidate_pos [last] [pl] = pos;
+  }
+
+
+  double AliasExcess (Vertex v, Player pl) const {
+    return max (act_gamma [v] [pl] - alias [pl].Weight (v), 0.0);
+  }
+
+
+  void RebuildAlias (Player pl) {
+    rep (ii, alias_patched [pl].Size ()) {
+      alias_is_patched [alias_patched [pl] [ii]] [pl] = false;
+    }
+    alias_patched [pl].Clear ();
+    alias_excess_sum [pl] = 0.0;
+
+    AliasTable& table = alias [pl];
+    table.Clear ();
+    rep (ii, board.EmptyVertexCount()) {
+      Vertex v = board.EmptyVertex (ii);
+      if (act_gamma [v] [pl] > 0.0) table.Add (v, act_gamma [v] [pl]);
+    }
+    table.Build ();
+  }
+
+
   void CheckLocalSumCorrect () const {
     // Tests
     if (!kCheckAsserts) return;
@@ -267,7 +481,7 @@ private:
         } else if (pl == board.ActPlayer() && v == board.KoVertex ()) {
           correct = 0.0;
         } else {
-          correct = gammas.Get (board.Hash3x3At (v), pl);
+          correct = PolicyGamma (v, pl);
         }
         CHECK2 (correct == act_gamma [v] [pl],
                 WW (act_gamma[v][pl]);
@@ -297,18 +511,42 @@ public:
   // act_gamma_sum is a sum of the above.
   NatMap <Vertex, NatMap<Player, double> > act_gamma;
   NatMap <Player, double> act_gamma_sum;
-  double proximity_bonus [2]; // TODO move this to Gammas 
+  // Indexed by ProximityTable::ProximityClass.
+  double proximity_bonus [ProximityTable::kClassCount]; // TODO move this to Gammas 
+  // Vertices within local_radius lines of the last move are local.
+  uint local_radius;
+
+  // Alias table sampling of non-local moves.
+  // The table is rebuilt when more than alias_rebuild_fraction
+  // of its vertices changed gamma.
+  bool use_alias;
+  double alias_rebuild_fraction;
+
+  SamplerStats stats;
 
 private:
   const Board& board;
   const Gammas& gammas;
+  const Gammas::Tab* policy_table;
+  const ProximityTable& proximity;
 
+  bool local_valid;
+  Player local_pl;
   NatSet <Vertex> is_in_local;
-  FastStack <Vertex, Board::kArea> local_vertices;
+  FastStack <Vertex, ProximityTable::kMaxNbrCount> local_vertices;
   NatMap <Vertex, double> local_gamma;
   double total_non_local_gamma;
   double total_local_gamma;
 
+  // Empty vertices with non-zero act_gamma, maintained if use_candidates.
+  bool use_candidates;
+  NatMap <Player, FastStack <Vertex, Board::kArea> > candidates;
+  NatMap <Vertex, NatMap <Player, uint> > candidate_pos;
+
+  NatMap <Player, AliasTable> alias;
+  NatMap <Player, double> alias_excess_sum;
+  NatMap <Player, FastStack <Vertex, Vertex::kBound> > alias_patched;
+  NatMap <Vertex, NatMap <Player, bool> > alias_is_patched;
 
   Vertex ko_v;
 };
@@ -1,13 +1,93 @@
 #include <iostream>
+#include <algorithm>
 #include <fstream>
 #include <cerrno>
 #include <cassert>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cctype>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
 
 #include "gtp.hpp"
 
 namespace Gtp {
 
-Io::Io (const string& params_) : params (params_), success(true), quit_gtp (false) { 
+// Output of RunAsync, shared by the reader and the worker.
+struct StreamSink {
+  ostream* out;
+  std::mutex mutex;
+  bool started;   // response header already written
+  int id;         // of the command run by the worker, -1 if none
+};
+
+namespace {
+  // "=id " or "?id ", GTP echoes the id of the command if it has one.
+  void WriteHeader (ostream& out, bool failure, int id) {
+    out << (failure ? '?' : '=');
+    if (id >= 0) out << id;
+    out << ' ';
+  }
+}
+
+namespace detail {
+
+void ArgBuf::Set (const char* begin, const char* end) {
+  setg (const_cast<char*> (begin), const_cast<char*> (begin), const_cast<char*> (end));
+}
+
+streambuf::pos_type ArgBuf::seekoff (off_type off, ios_base::seekdir dir,
+                                     ios_base::openmode which)
+{
+  off_type size = egptr () - eback ();
+  off_type base = 0;
+  if (dir == ios_base::cur) base = gptr () - eback ();
+  if (dir == ios_base::end) base = size;
+  off_type pos = base + off;
+  if (!(which & ios_base::in) || pos < 0 || pos > size) return pos_type (off_type (-1));
+  setg (eback (), eback () + pos, egptr ());
+  return pos_type (pos);
+}
+
+streambuf::pos_type ArgBuf::seekpos (pos_type pos, ios_base::openmode which) {
+  return seekoff (off_type (pos), ios_base::beg, which);
+}
+
+streambuf::int_type ReportBuf::overflow (int_type c) {
+  if (!traits_type::eq_int_type (c, traits_type::eof ())) {
+    text.push_back (traits_type::to_char_type (c));
+  }
+  return traits_type::not_eof (c);
+}
+
+streamsize ReportBuf::xsputn (const char* s, streamsize n) {
+  text.append (s, n);
+  return n;
+}
+
+} // namespace detail
+
+Io::Io ()
+  : in (&in_buf), out (&out_buf), command_begin (0), command_end (0), id (-1),
+    sink (NULL), success (true), quit_gtp (false) {
+}
+
+bool Io::CanStream () const {
+  return sink != NULL;
+}
+
+void Io::StreamLine (const string& line) {
+  std::lock_guard<std::mutex> lock (sink->mutex);
+  if (!sink->started) {
+    WriteHeader (*sink->out, false, sink->id);
+    *sink->out << endl;
+  }
+  sink->started = true;
+  *sink->out << line << endl;
 }
 
 string Io::ReadLine () {
@@ -21,7 +101,7 @@ string Io::ReadLine () {
 }
 
 void Io::SetError (const string& message) {
-  out.str (message);
+  out_buf.text = message;
   success = false;
 }
 
@@ -36,30 +116,66 @@ void Io::CheckEmpty() {
 }
 
 bool Io::IsEmpty() {
-  string s;
+  in.clear();
   std::streampos pos = in.tellg();
-  in >> s;
-  bool ok = s.empty();
-  in.seekg(pos);
+  in >> ws;
+  bool ok = in.peek() == char_traits<char>::eof();
   in.clear();
+  in.seekg(pos);
   return ok;
 }
 
+bool Io::ParseLine (const string& line) {
+  text.clear ();
+  for (unsigned int ii = 0; ii != line.size (); ii += 1) {
+    char c = line [ii];
+    if (false) {}
+    else if (c == '\t') text += ' ';
+    else if (c == '\n') assert (false);
+    else if (c <= 31 || c == 127) continue;
+    else if (c == '#') break;  // remove comments
+    else text += c;
+  }
+
+  // [id] command arguments, only spaces are left
+  size_t ii = 0;
+  while (ii < text.size () && text [ii] == ' ') ii += 1;
+  id = -1;
+  while (ii < text.size () && isdigit (text [ii])) {
+    id = max (id, 0) * 10 + (text [ii] - '0');
+    ii += 1;
+  }
+  while (ii < text.size () && text [ii] == ' ') ii += 1;
+  command_begin = ii;
+  while (ii < text.size () && text [ii] != ' ') ii += 1;
+  command_end = ii;
+  return command_end > command_begin;
+}
+
+void Io::Start (StreamSink* new_sink) {
+  out.clear ();
+  out_buf.text.clear ();
+  sink = new_sink;
+  success = true;
+  quit_gtp = false;
+}
+
 void Io::PrepareIn () {
   in.clear();
-  in.str (params);
+  in_buf.Set (text.data () + command_end, text.data () + text.size ());
 }
 
-string Io::Report () const {
-  string s = out.str ();
-  while (s.size () > 0 && 
-	 (s [s.size() - 1] == '\n' ||
-	  s [s.size() - 1] == ' ' ||
-	  s [s.size() - 1] == '\t')) 
+void Io::Report (string* report) const {
+  const string& s = out_buf.text;
+  size_t size = s.size ();
+  while (size > 0 &&
+         (s [size - 1] == '\n' ||
+          s [size - 1] == ' ' ||
+          s [size - 1] == '\t'))
   {
-    s.resize (s.size() - 1);
+    size -= 1;
   }
-  return s;
+  report->assign (s, 0, size);
 }
 
 // -----------------------------------------------------------------------------
@@ -77,80 +193,145 @@ Repl::Callback StaticCommand (const string& ret) {
 
 // -----------------------------------------------------------------------------
 
-Repl::Repl () {
+namespace {
+  // FNV-1a
+  size_t HashName (const char* name, size_t size) {
+    unsigned int hash = 2166136261u;
+    for (size_t ii = 0; ii != size; ii += 1) {
+      hash ^= (unsigned char) name [ii];
+      hash *= 16777619u;
+    }
+    return hash;
+  }
+}
+
+Repl::Repl ()
+  : slots (16, -1), active_sink (NULL), async_queue (NULL), nesting (0), interrupt (false)
+{
   Register ("list_commands", this, &Repl::CListCommands);
   Register ("help",          this, &Repl::CListCommands);
   Register ("known_command", this, &Repl::CKnownCommand);
   Register ("quit",          this, &Repl::CQuit);
   Register ("gtpfile",       this, &Repl::CGtpFile);
+  Register ("stop",          this, &Repl::CStop);
+  SetImmediate ("list_commands");
+  SetImmediate ("help");
+  SetImmediate ("known_command");
+  SetImmediate ("stop");
+}
+
+Repl::~Repl () {
+  for (size_t ii = 0; ii != io_stack.size (); ii += 1) delete io_stack [ii];
+}
+
+const Repl::Command* Repl::FindCommand (const char* name, size_t size) const {
+  size_t mask = slots.size () - 1;
+  for (size_t slot = HashName (name, size) & mask;
+       slots [slot] != -1;
+       slot = (slot + 1) & mask)
+  {
+    const Command& command = commands [slots [slot]];
+    if (command.name.size () == size &&
+        memcmp (command.name.data (), name, size) == 0) {
+      return &command;
+    }
+  }
+  return NULL;
+}
+
+Repl::Command& Repl::AddCommand (const string& name) {
+  const Command* found = FindCommand (name.data (), name.size ());
+  if (found != NULL) return commands [found - commands.data ()];
+
+  Command command;
+  command.name = name;
+  command.immediate = false;
+  command.streaming = false;
+  commands.push_back (command);
+
+  // At most half full, so the probes stay short.
+  size_t first = commands.size () - 1;
+  if (2 * commands.size () > slots.size ()) {
+    slots.assign (2 * slots.size (), -1);
+    first = 0;
+  }
+  size_t mask = slots.size () - 1;
+  for (size_t ii = first; ii != commands.size (); ii += 1) {
+    size_t slot = HashName (commands [ii].name.data (), commands [ii].name.size ()) & mask;
+    while (slots [slot] != -1) slot = (slot + 1) & mask;
+    slots [slot] = ii;
+  }
+  return commands.back ();
 }
 
 void Repl::Register (const string& name, Callback callback) {
-  callbacks[name].push_back (callback);
+  AddCommand (name).callbacks.push_back (callback);
+}
+
+void Repl::SetObserver (Observer new_observer) {
+  observer = new_observer;
 }
 
 void Repl::RegisterStatic (const string& name, const string& response) {
   Register (name, StaticCommand(response));
+  SetImmediate (name);
 }
 
-void ParseLine (const string& line, int* id, string* command, string* rest) {
-  stringstream ss;
-  for (unsigned int ii = 0; ii != line.size (); ii += 1) {
-    char c = line [ii];
-    if (false) {}
-    else if (c == '\t') ss << ' ';
-    else if (c == '\n') assert (false);
-    else if (c <= 31 || c == 127) continue;
-    else if (c == '#') break;  // remove comments
-    else ss << c;
-  }
-  *id = -1;
-  *command = "";
-  *rest = "";
-  ss >> *id;
-  if (!ss) {
-    ss.clear ();
-    ss.seekg (ios_base::beg);
-  }
-  ss >> *command;
-  getline (ss, *rest);
+void Repl::SetImmediate (const string& name) {
+  AddCommand (name).immediate = true;
 }
 
-Repl::Status Repl::RunOneCommand (const string& line, string* report) {
-  int id;
-  string command, params;
+void Repl::SetStreaming (const string& name) {
+  AddCommand (name).streaming = true;
+}
 
-  ParseLine (line, &id, &command, &params);
+const std::atomic<bool>* Repl::InterruptFlag () const {
+  return &interrupt;
+}
 
-  Io io(params);
+Repl::Status Repl::RunOneCommand (const string& line, string* report) {
+  if (size_t (nesting) == io_stack.size ()) io_stack.push_back (new Io);
+  Io& io = *io_stack [nesting];
+
+  report->clear ();
+  if (!io.ParseLine (line)) return NoOp;
+
+  nesting += 1;
+  Status status = Execute (io, report, nesting == 1 ? active_sink : NULL);
+  nesting -= 1;
+  // An interrupt ends only the command it was raised for, so a stop in
+  // a gtpfile doesn't cut the searches after it.
+  interrupt = false;
+  if (observer && nesting == 0) observer (line, status, *report);
+  return status;
+}
 
-  *report = "";
-  if (command == "") return NoOp;
+Repl::Status Repl::Execute (Io& io, string* report, StreamSink* sink) {
+  io.Start (sink);
 
-  if (IsCommand (command)) {
+  const Command* command = FindCommand (io.Command (), io.CommandSize ());
+  if (command != NULL && !command->callbacks.empty ()) {
     // Callback call with optional fast return.
-    list<Callback>& cmd_list = callbacks [command];
-    for (list<Callback>::iterator cmd = cmd_list.begin();
-	 cmd != cmd_list.end();
-	 ++cmd)
-    {
+    const vector<Callback>& cmd_list = command->callbacks;
+    for (size_t ii = 0; ii != cmd_list.size (); ii += 1) {
       io.PrepareIn();
-      try { (*cmd) (io); } catch (Return) { }
+      try { cmd_list [ii] (io); } catch (Return) { }
     }
   } else {
-    io.SetError ("unknown command: \"" + command + "\"");
+    io.SetError ("unknown command: \"" + string (io.Command (), io.CommandSize ()) + "\"");
   }
 
-  *report = io.Report();
+  io.Report (report);
   if (io.quit_gtp) return Quit;
   if (io.success)  return Success;
   return Failure;
 }
 
-void Repl::Run (istream& in, ostream& out) {
+unsigned int Repl::Run (istream& in, ostream& out) {
+  unsigned int command_cnt = 0;
+  string line, report, response;
   in.clear();
   while (true) {
-    string line, report;
     if (!getline (in, line)) {
       if (errno == EINTR) {
         errno = 0;
@@ -162,23 +343,163 @@ void Repl::Run (istream& in, ostream& out) {
 
     Status status = RunOneCommand (line, &report);
     if (status == NoOp) continue;
+    command_cnt += 1;
+
+    // One write, out may be unbuffered (cerr of gtpfile).
+    int id = io_stack [nesting]->id;
+    char header [16];
+    if (id >= 0) {
+      sprintf (header, "%c%d ", status == Failure ? '?' : '=', id);
+    } else {
+      sprintf (header, "%c ", status == Failure ? '?' : '=');
+    }
+    response.assign (header);
+    response += report;
+    response += "\n\n";
+    out << response << flush;
+
+    if (status == Quit) break;
+  }
+  return command_cnt;
+}
+
+// Lines read by the reader thread of RunAsync, waiting for the worker.
+struct LineQueue {
+  std::mutex mutex;
+  std::condition_variable ready;
+  deque <string> lines;
+  bool closed;     // end of input
+  bool busy;       // worker runs a command
+  bool streaming;  // ... and it runs until the next one
+  StreamSink sink;
+};
+
+namespace {
+  // Responses of streaming commands already have the header.
+  void WriteResponse (StreamSink& sink, Repl::Status status, int id,
+                      const string& report, bool end_stream)
+  {
+    std::lock_guard<std::mutex> lock (sink.mutex);
+    if (end_stream && sink.started) {
+      if (report != "") *sink.out << report << endl;
+      *sink.out << endl;
+      sink.started = false;
+      return;
+    }
+    WriteHeader (*sink.out, status == Repl::Failure, id);
+    *sink.out << report << endl << endl;
+  }
+}
 
-    out << (status == Failure ? "?" : "=") << " "
-        << report
-        << endl << endl;
+void Repl::RunAsync (istream& in, ostream& out) {
+  LineQueue* queue = new LineQueue;   // the reader may outlive this call
+  queue->closed = false;
+  queue->busy = false;
+  queue->streaming = false;
+  queue->sink.out = &out;
+  queue->sink.started = false;
+  queue->sink.id = -1;
+  async_queue = queue;
+  interrupt = false;
+
+  std::thread reader ([this, &in, queue] () {
+    in.clear();
+    Io io;
+    string line, report;
+    while (true) {
+      if (!getline (in, line)) {
+        if (errno == EINTR) {
+          errno = 0;
+          in.clear();
+          continue;
+        }
+        break;
+      }
+
+      bool has_command = io.ParseLine (line);
+      std::unique_lock<std::mutex> lock (queue->mutex);
+      if (line.find ("# interrupt") == 0) {
+        if (queue->busy) interrupt = true;
+        continue;
+      }
+      if (!has_command) continue;
+      const Command* command = FindCommand (io.Command (), io.CommandSize ());
+      // A streaming response is open, an immediate one would land in it,
+      // so it waits in the queue like any other command and ends the stream.
+      bool streaming = queue->busy && queue->streaming;
+      if (command != NULL && command->immediate && queue->lines.empty () &&
+          !streaming) {
+        lock.unlock ();
+        Status status = Execute (io, &report, NULL);
+        WriteResponse (queue->sink, status, io.id, report, false);
+        continue;
+      }
+      if (streaming) interrupt = true;
+      queue->lines.push_back (line);
+      queue->ready.notify_one ();
+    }
+    std::lock_guard<std::mutex> lock (queue->mutex);
+    queue->closed = true;
+    if (queue->busy && queue->streaming) interrupt = true;
+    queue->ready.notify_one ();
+  });
+
+  Io parsed;
+  string line, report;
+  while (true) {
+    {
+      std::unique_lock<std::mutex> lock (queue->mutex);
+      while (queue->lines.empty () && !queue->closed) queue->ready.wait (lock);
+      if (queue->lines.empty ()) break;
+      line.swap (queue->lines.front ());
+      queue->lines.pop_front ();
+      parsed.ParseLine (line);
+      const Command* command = FindCommand (parsed.Command (), parsed.CommandSize ());
+      queue->busy = true;
+      queue->streaming = command != NULL && command->streaming;
+      queue->sink.id = parsed.id;
+      // A streaming command with more input waiting ends at once.
+      interrupt = queue->streaming && (!queue->lines.empty () || queue->closed);
+    }
 
+    active_sink = &queue->sink;
+    Status status = RunOneCommand (line, &report);
+    active_sink = NULL;
+    {
+      std::lock_guard<std::mutex> lock (queue->mutex);
+      queue->busy = false;
+      queue->streaming = false;
+      interrupt = false;
+    }
+    if (status == NoOp) continue;
+    WriteResponse (queue->sink, status, parsed.id, report, true);
     if (status == Quit) break;
   }
+
+  // After quit the reader is blocked on input, it is left behind.
+  bool closed;
+  {
+    std::lock_guard<std::mutex> lock (queue->mutex);
+    closed = queue->closed;
+  }
+  if (closed) {
+    reader.join ();
+    async_queue = NULL;
+    delete queue;
+  } else {
+    reader.detach ();
+  }
 }
 
 void Repl::CListCommands (Io& io) {
   io.CheckEmpty();
-  pair<string, list<Callback> > p;
-  for (map <string, list<Callback> >::iterator cb = callbacks.begin();
-       cb != callbacks.end();
-       ++cb)
-  {
-    io.out << cb->first << endl;
+  vector <string> names;
+  for (size_t ii = 0; ii != commands.size (); ii += 1) {
+    if (!commands [ii].callbacks.empty ()) names.push_back (commands [ii].name);
+  }
+  sort (names.begin (), names.end ());
+  for (size_t ii = 0; ii != names.size (); ii += 1) {
+    io.out << names [ii] << endl;
   }
 }
 
@@ -201,11 +522,25 @@ void Repl::CGtpFile (Io& io) {
     io.SetError ("No such file: \"" + file + "\"");
     return;
   }
-  Run (in, cerr);
+  std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now ();
+  unsigned int command_cnt = Run (in, cerr);
+  std::chrono::duration<double> seconds = std::chrono::steady_clock::now () - begin;
+  cerr << "gtpfile: " << command_cnt << " commands in " << seconds.count () << " s ("
+       << (unsigned int) (command_cnt / max (seconds.count (), 1e-9)) << " commands/s)"
+       << endl;
+}
+
+void Repl::CStop (Io& io) {
+  io.CheckEmpty();
+  // Without RunAsync stop itself is the running command.
+  if (async_queue == NULL) return;
+  std::lock_guard<std::mutex> lock (async_queue->mutex);
+  if (async_queue->busy) interrupt = true;
 }
 
 bool Repl::IsCommand (const string& name) {
-  return callbacks.find(name) != callbacks.end();
+  const Command* command = FindCommand (name.data (), name.size ());
+  return command != NULL && !command->callbacks.empty ();
 }
 
 namespace detail {
@@ -221,11 +556,40 @@ namespace detail {
   Specialization(char);
   Specialization(int);
   Specialization(unsigned int);
-  Specialization(float);
-  Specialization(double);
   Specialization(string);
 #undef Specialization
 
+  // Without the digit string of num_get, which is allocated on the
+  // heap for every float.
+  double ReadDouble (istream& in) {
+    char buf [64];
+    size_t size = 0;
+    in >> ws;
+    while (size + 1 < sizeof (buf) &&
+           in.peek () != char_traits<char>::eof () &&
+           !isspace (in.peek ())) {
+      buf [size++] = in.get ();
+    }
+    buf [size] = 0;
+    char* end;
+    double x = strtod (buf, &end);
+    if (end == buf) {
+      in.setstate (ios_base::failbit);
+    } else {
+      // The rest is left for the next read, like num_get does.
+      for (const char* p = buf + size; p != end; --p) in.unget ();
+    }
+    return x;
+  }
+
+  template<> float IoReadOfStream<float> (istream& in) {
+    return ReadDouble (in);
+  }
+
+  template<> double IoReadOfStream<double> (istream& in) {
+    return ReadDouble (in);
+  }
+
 } // namespace detail
 
 } // namespace Gtp
@@ -1,10 +1,13 @@
 #ifndef GTP_H_
 #define GTP_H_
 
+#include <atomic>
 #include <list>
 #include <map>
+#include <set>
 #include <sstream>
 #include <string>
+#include <vector>
 #include <functional>
 
 namespace Gtp {
@@ -15,11 +18,40 @@ using std::placeholders::_1;
 // -----------------------------------------------------------------------------
 // Command communication interface.
 
+struct StreamSink;
+struct LineQueue;
+
+namespace detail {
+  // Istream buffer reading a range of chars in place.
+  class ArgBuf : public streambuf {
+  public:
+    void Set (const char* begin, const char* end);
+  protected:
+    pos_type seekoff (off_type off, ios_base::seekdir dir, ios_base::openmode which);
+    pos_type seekpos (pos_type pos, ios_base::openmode which);
+  };
+
+  // Ostream buffer appending to text, which keeps its capacity between
+  // commands.
+  class ReportBuf : public streambuf {
+  public:
+    string text;
+  protected:
+    int_type overflow (int_type c);
+    streamsize xsputn (const char* s, streamsize n);
+  };
+}
+
 class Io {
+  // Io objects are reused by Repl, so a command allocates nothing
+  // unless its arguments or response grow past the previous ones.
+  detail::ArgBuf in_buf;     // before in and out, they are built on them
+  detail::ReportBuf out_buf;
+
 public:
 
-  istringstream in;
-  ostringstream out;
+  istream in;
+  ostream out;
 
   // Repl Will print "? message" on the output
   void SetError (const string& message);
@@ -39,15 +71,32 @@ public:
   // Throws syntax_error if a non-whitespace is still in in
   void CheckEmpty ();
 
+  // Streaming commands (Repl::SetStreaming) can send lines before the
+  // end of the response, when run by Repl::RunAsync.
+  bool CanStream () const;
+  void StreamLine (const string& line);
+
 private:
   friend class Repl;
 
-  Io (const string& params);
-  void PrepareIn ();
-  string Report () const;
+  Io ();
+
+  // Cleans the line (comments, control characters and id are removed)
+  // into text. Returns false if there is no command.
+  bool ParseLine (const string& line);
+  const char* Command () const { return text.data () + command_begin; }
+  size_t CommandSize () const { return command_end - command_begin; }
+
+  void Start (StreamSink* sink);  // before the first callback
+  void PrepareIn ();              // before each callback
+  void Report (string* report) const;
 
 private:
-  const string& params;
+  string text;
+  size_t command_begin;
+  size_t command_end;    // arguments are the rest of text
+  int id;                // -1 if the line has none
+  StreamSink* sink;
   bool success;
   bool quit_gtp;
 };
@@ -61,6 +110,7 @@ public:
   typedef std::function< void(Io&) > Callback;
 
   Repl ();
+  ~Repl ();
 
   void Register (const string& name, Callback command);
 
@@ -78,7 +128,38 @@ public:
 
   Status RunOneCommand (const string& line, string* report);
 
-  void Run (istream&, ostream&);
+  // Called after every command that is not a NoOp, except commands
+  // run from a gtpfile (the gtpfile command itself is reported).
+  typedef std::function< void(const string& line, Status, const string& report) > Observer;
+  void SetObserver (Observer observer);
+
+  // Returns the number of commands run (comments and empty lines
+  // don't count).
+  unsigned int Run (istream&, ostream&);
+
+  // Like Run, but lines are read by a separate thread and queued for
+  // this one. Immediate commands are answered by the reader thread at
+  // once if no other command is waiting, even when a long command is
+  // running, unless it is a streaming one: then they are queued and
+  // end it like any other command. "# interrupt" (GoGui) and the "stop"
+  // command raise the interrupt flag for the running command.
+  //
+  // So responses can come out of order: a controller that sends a
+  // command before the previous response arrived must give commands
+  // ids and match responses by them (=id / ?id).
+  void RunAsync (istream&, ostream&);
+
+  // Immediate commands must be safe to run concurrently with any other
+  // command.
+  void SetImmediate (const string& name);
+
+  // Streaming commands run until the next command arrives (the
+  // interrupt flag is raised then), see Io::StreamLine.
+  void SetStreaming (const string& name);
+
+  // Raised until the running command finishes. Long commands should
+  // poll it and return early.
+  const std::atomic<bool>* InterruptFlag () const;
 
   bool IsCommand (const string& name);
 
@@ -88,14 +169,37 @@ private:
 
   friend class Io;
 
+  struct Command {
+    string name;
+    vector <Callback> callbacks;
+    bool immediate;
+    bool streaming;
+  };
+
+  // Open addressing table of commands, the name is hashed once per
+  // line and compared in place.
+  const Command* FindCommand (const char* name, size_t size) const;
+  Command& AddCommand (const string& name);   // finds or adds
+
   // commands built-in into interpreter (registered during interpreter construction)
   void CListCommands (Io&);
   void CKnownCommand (Io&);
   void CQuit (Io&);
   void CGtpFile (Io&);
-  
+  void CStop (Io&);
+
+  // Runs callbacks of the command parsed by io, without observer.
+  Status Execute (Io& io, string* report, StreamSink* sink);
+
 private:
-  map <string, list<Callback> > callbacks;
+  vector <Command> commands;
+  vector <int> slots;       // indices of commands, -1 for empty
+  vector <Io*> io_stack;    // io_stack [nesting] for RunOneCommand
+  StreamSink* active_sink;  // of the command run by RunAsync
+  LineQueue* async_queue;   // of the running RunAsync, NULL otherwise
+  Observer observer;
+  int nesting;
+  std::atomic<bool> interrupt;
 };
 
 // Creates a callback that:
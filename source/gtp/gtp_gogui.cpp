@@ -42,11 +42,21 @@ void GoguiGfx::SetStatusBar (const string& status) {
 }
 
 void GoguiGfx::Report (Io& io)  {
+  Write (io.out);
+}
+
+void GoguiGfx::ReportLive (ostream& out)  {
+  out << "gogui-gfx:" << endl;
+  Write (out);
+  out << endl;
+}
+
+void GoguiGfx::Write (ostream& out)  {
   for (map <string, string>::iterator it = gfx_output.begin();
        it != gfx_output.end();
        ++it)
   {
-    io.out << it->first << " " << it->second << endl;
+    out << it->first << " " << it->second << endl;
   }
 }
 
@@ -68,12 +78,21 @@ void ReplWithGogui::RegisterGfx (const string& name,
   }
 }
 
-void ReplWithGogui::CParam (const string& cmd_name, Io& io) {
-  map<string, Callback>& vars = params[cmd_name];
+void ReplWithGogui::RegisterParam (const string& cmd_name,
+                                   const string& param_name,
+                                   Callback get_set)
+{
+  params [cmd_name] [param_name] = get_set;
+  if (IsCommand (cmd_name)) return;
+  analyze_list << "param/" << cmd_name << "/" << cmd_name << endl; // NOTE: factor out
+  Register (cmd_name, std::bind (&ReplWithGogui::CParam, this, &params [cmd_name], _1));
+}
+
+void ReplWithGogui::CParam (map <string, Callback>* vars, Io& io) {
   if (io.IsEmpty ()) {
     // print all vars and their values
-    for (map <string, Callback>::iterator it = vars.begin();
-	 it != vars.end();
+    for (map <string, Callback>::iterator it = vars->begin();
+	 it != vars->end();
 	 ++it)
     {
       io.out << "[string] " << it->first << " ";
@@ -81,12 +100,13 @@ void ReplWithGogui::CParam (const string& cmd_name, Io& io) {
       io.out << endl;
     }
   } else {
-    string var_name = io.Read<string> ();
-    if (vars.find (var_name) == vars.end ()) {
+    io.in >> var_name;
+    map <string, Callback>::iterator it = vars->find (var_name);
+    if (it == vars->end ()) {
       io.SetError ("unknown variable: \"" + var_name + "\"");
       return;
     }
-    vars[var_name] (io);
+    it->second (io);
   }
 }
 
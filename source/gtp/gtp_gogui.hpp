@@ -29,7 +29,12 @@ public:
 
   void Report (Io& io);
 
+  // GoGui live graphics, the "gogui-gfx:" block on stderr.
+  void ReportLive (ostream& out);
+
 private:
+  void Write (ostream& out);
+
   map <string, string> gfx_output;
 };
 
@@ -50,13 +55,17 @@ public:
   template <typename T>
   void RegisterParam (const string& cmd_name, const string& param_name, T* param);
 
+  // Callback prints the value without arguments and sets it otherwise.
+  void RegisterParam (const string& cmd_name, const string& param_name, Callback get_set);
+
 private:
   void CAnalyze (Io&);
-  void CParam (const string& cmd_name, Io& io);
+  void CParam (map <string, Callback>* vars, Io& io);
 
 private:
   stringstream analyze_list;
   map <string, map <string, Callback> > params; // params [cmd_name] [param_name]
+  string var_name;   // of CParam, kept for its capacity
 };
 
 // -----------------------------------------------------------------------------
@@ -76,10 +85,7 @@ void ReplWithGogui::RegisterParam (const string& cmd_name,
                                    const string& param_name,
                                    T* param)
 {
-  params [cmd_name] [param_name] = GetSetCallback (param);
-  if (IsCommand (cmd_name)) return;
-  analyze_list << "param/" << cmd_name << "/" << cmd_name << endl; // NOTE: factor out
-  Register (cmd_name, std::bind (&ReplWithGogui::CParam, this, cmd_name, _1));
+  RegisterParam (cmd_name, param_name, GetSetCallback (param));
 }
 
 } // namespace Gtp
@@ -2,6 +2,8 @@
 // Copyright 2006 and onwards, Lukasz Lew
 //
 
+#include <thread>
+
 #include "gtp_gogui.hpp"
 
 Gtp::ReplWithGogui gtp;
@@ -11,6 +13,7 @@ Gtp::ReplWithGogui gtp;
 //#include "gui.h"
 #include "mcts_gtp.hpp"
 #include "mm_train.hpp"
+#include "replay.hpp"
 
 
 
@@ -25,10 +28,26 @@ void GtpBenchmark (Gtp::Io& io) {
   io.out << Benchmark::Run (n);
 }
 
+void GtpBenchmarkMt (Gtp::Io& io) {
+  uint n = io.Read<uint> (100000);
+  uint threads = io.Read<uint> (max (1u, std::thread::hardware_concurrency ()));
+  io.CheckEmpty ();
+  if (threads == 0) {
+    io.SetError ("thread count has to be positive");
+    return;
+  }
+  io.out << Benchmark::RunMt (n, threads);
+}
+
 void GtpPerft (Gtp::Io& io) {
   uint d = io.Read<uint> (3);
+  uint threads = io.Read<uint> (max (1u, std::thread::hardware_concurrency ()));
   io.CheckEmpty ();
-  io.out << Perft::Run (d);
+  if (d == 0 || threads == 0) {
+    io.SetError ("depth and thread count have to be positive");
+    return;
+  }
+  io.out << Perft::Run (d, threads);
 }
 
 void GtpBoardTest (Gtp::Io& io) {
@@ -58,6 +77,7 @@ int main(int argc, char** argv) {
   gtp.RegisterStatic("version", STRING(VERSION));
   gtp.RegisterStatic("protocol_version", "2");
   gtp.Register ("benchmark", GtpBenchmark);
+  gtp.Register ("benchmark_mt", GtpBenchmarkMt);
   gtp.Register ("board_test", GtpBoardTest);
   gtp.Register ("sampler_test", GtpSamplerTest);
   gtp.Register ("mm_test", GtpMmTest);
@@ -65,16 +85,33 @@ int main(int argc, char** argv) {
 
   Engine& engine = *(new Engine());
   MctsGtp mcts_gtp (engine);
+  ReplayLog replay_log (engine);
 
+  // --record file: log the session for --replay file.
+  vector <string> args;
   reps (ii, 1, argc) {
-    if (ii == argc-1 && string (argv[ii]) == "gtp") continue;
+    string arg = argv[ii];
+    if ((arg == "--record" || arg == "--replay") && ii+1 < argc) {
+      string file = argv[++ii];
+      if (arg == "--replay") return replay_log.Replay (file, cout) ? 0 : 1;
+      if (!replay_log.Record (file)) {
+        cerr << "Can't open replay log: \"" << file << "\"" << endl;
+        return 1;
+      }
+      continue;
+    }
+    args.push_back (arg);
+  }
+
+  rep (ii, args.size()) {
+    if (ii == args.size()-1 && args[ii] == "gtp") continue;
     string response;
-    switch (gtp.RunOneCommand (argv[ii], &response)) {
+    switch (gtp.RunOneCommand (args[ii], &response)) {
     case Gtp::Repl::Success:
       cerr << response << endl;
       break;
     case Gtp::Repl::Failure:
-      cerr << "Command: \"" << argv[ii] << "\" failed." << endl;
+      cerr << "Command: \"" << args[ii] << "\" failed." << endl;
       return 1;
     case Gtp::Repl::NoOp:
       break;
@@ -84,8 +121,8 @@ int main(int argc, char** argv) {
     }
   }
 
-  if (argc == 1 || string(argv[argc-1]) == "gtp") {
-    gtp.Run (cin, cout);
+  if (args.empty() || args.back() == "gtp") {
+    gtp.RunAsync (cin, cout);
   }
 
   delete &engine;
@@ -0,0 +1,130 @@
+#ifndef REPLAY_H_
+#define REPLAY_H_
+
+#include <cstdio>
+#include <fstream>
+
+#include "engine.hpp"
+
+// Record and replay of a GTP session, for bisecting performance and
+// strength regressions on a fixed workload.
+//
+// Log format, one line per top level GTP command:
+//   seed <engine random seed at the start of recording>
+//   <status> <response hash> <playouts|-> <command line>
+// where status is '=', '?' or 'q' (quit). Searches are limited by
+// time, so the log keeps the playout count of each of them and the
+// replay repeats it exactly.
+
+class ReplayLog {
+public:
+  explicit ReplayLog (Engine& engine) : engine (engine), search_cnt (0) {
+  }
+
+  bool Record (const string& file_name) {
+    out.open (file_name.c_str ());
+    if (!out) return false;
+    // The log has only the seed, so the generator restarts from it.
+    engine.random.SetSeed (engine.random.GetSeed ());
+    out << "seed " << engine.random.GetSeed () << endl;
+    search_cnt = engine.time_control.search_cnt;
+    gtp.SetObserver (std::bind (&ReplayLog::CommandDone, this,
+                                std::placeholders::_1,
+                                std::placeholders::_2,
+                                std::placeholders::_3));
+    return true;
+  }
+
+  // Reruns the log, prints time of each command and returns false if
+  // the log can't be read or a search gave a different response.
+  bool Replay (const string& file_name, ostream& report) {
+    ifstream in (file_name.c_str ());
+    string word;
+    uint seed;
+    if (!(in >> word >> seed) || word != "seed") {
+      report << "can't read replay log: " << file_name << endl;
+      return false;
+    }
+    engine.random.SetSeed (seed);
+
+    string line;
+    getline (in, line);
+    uint command_cnt = 0;
+    uint differ_cnt = 0;
+    uint search_differ_cnt = 0;
+    double total = 0.0;
+
+    while (getline (in, line)) {
+      istringstream entry (line);
+      string status, hash, playouts, command;
+      entry >> status >> hash >> playouts >> ws;
+      getline (entry, command);
+      if (command.empty ()) continue;
+
+      bool search = playouts != "-";
+      engine.time_control.replay_playouts = search ? atoi (playouts.c_str ()) : 0;
+      string response;
+      double begin = WallTime ();
+      Gtp::Repl::Status result = gtp.RunOneCommand (command, &response);
+      double seconds = WallTime () - begin;
+      engine.time_control.replay_playouts = 0;
+
+      bool same = StatusChar (result) == status && HashString (response) == hash;
+      command_cnt += 1;
+      total += seconds;
+      differ_cnt += !same;
+      search_differ_cnt += !same && search;
+
+      char buf [40];
+      sprintf (buf, "%10.4f s  ", seconds);
+      report << buf << command << (same ? "" : "  [differs]") << endl;
+      if (result == Gtp::Repl::Quit) break;
+    }
+
+    report << command_cnt << " commands in " << total << " s, "
+           << differ_cnt << " responses differ, "
+           << search_differ_cnt << " of them after a search" << endl;
+    return search_differ_cnt == 0;
+  }
+
+private:
+  void CommandDone (const string& line, Gtp::Repl::Status status, const string& report) {
+    const TimeControl& tc = engine.time_control;
+    out << StatusChar (status) << " " << HashString (report) << " ";
+    if (tc.search_cnt != search_cnt) {
+      out << tc.last_playouts;
+    } else {
+      out << "-";
+    }
+    search_cnt = tc.search_cnt;
+    out << " " << line << endl;
+  }
+
+  static string StatusChar (Gtp::Repl::Status status) {
+    switch (status) {
+    case Gtp::Repl::Success: return "=";
+    case Gtp::Repl::Failure: return "?";
+    case Gtp::Repl::Quit:    return "q";
+    case Gtp::Repl::NoOp:    return "-";
+    }
+    return "-";
+  }
+
+  // FNV-1a
+  static string HashString (const string& s) {
+    uint64 hash = 14695981039346656037ULL;
+    rep (ii, s.size ()) {
+      hash ^= (unsigned char) s [ii];
+      hash *= 1099511628211ULL;
+    }
+    char buf [20];
+    sprintf (buf, "%016llx", (unsigned long long) hash);
+    return buf;
+  }
+
+  Engine& engine;
+  ofstream out;
+  uint search_cnt;
+};
+
+#endif
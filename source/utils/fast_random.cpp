@@ -9,73 +9,81 @@
 #include <time.h>
 #endif
 
-//tr1::minstd_rand0 mt; // this is eqivalent when #include <tr1/random>
-
-FastRandom::FastRandom (uint seed) : seed (seed) {
+FastRandom::FastRandom (uint seed) : increment (1) {
+  SetSeed (seed);
 }
 
-FastRandom::FastRandom () : seed (TimeSeed()) {
+FastRandom::FastRandom (uint seed, uint stream) : increment ((uint64 (stream) << 1) | 1) {
+  SetSeed (seed);
 }
 
-void FastRandom::SetSeed (uint new_seed) { 
-  seed = new_seed;
+FastRandom::FastRandom () : increment (1) {
+  SetSeed (TimeSeed());
 }
 
-uint FastRandom::GetSeed () { 
-  return seed; 
+// pcg32_srandom
+void FastRandom::SetSeed (uint new_seed) {
+  seed = new_seed;
+  state = 0;
+  GetNextUint ();
+  state += new_seed;
+  GetNextUint ();
 }
 
-uint FastRandom::GetNextUint () { // a number between  0 ... (uint(1)<<31) - 1 - 1
-  uint hi, lo;
-  lo = 16807 * (seed & 0xffff);
-  hi = 16807 * (seed >> 16);
-  lo += (hi & 0x7fff) << 16;
-  lo += hi >> 15;
-  seed = (lo & 0x7FFFFFFF) + (lo >> 31);
+uint FastRandom::GetSeed () {
   return seed;
 }
 
-// n must be between 1 .. (1<<16) + 1
-uint FastRandom::GetNextUint (uint n) { // 0 .. n-1
-  ASSERT (n > 0);
-  ASSERT (n <= (1<<16)+1);
-  return ((GetNextUint() & 0xffff) * n) >> 16;
-}
-
-double FastRandom::NextDouble () {
-  const double inv_max_uint = 1.0 / double (uint(1) << 31); // TODO - 1 - 1
-  return GetNextUint() * inv_max_uint;
-}
+// States are made in chunks: each one is the state kLanes positions
+// back jumped by kLanes steps, so both loops below vectorize.
+void FastRandom::Fill (uint* out, uint n) {
+  const uint kLanes = 8;
+  const uint kChunk = 256;
+  uint64 states [kChunk + kLanes];
+  uint64 lane_mult = 1;
+  uint64 lane_plus = 0;
+  uint64 s = state;
+  rep (ii, kLanes) {
+    states [ii] = s;
+    s = s * kMultiplier + increment;
+    lane_plus = lane_plus * kMultiplier + increment;
+    lane_mult *= kMultiplier;
+  }
 
-double FastRandom::NextDouble (double scale) {
-  const double inv_max_uint = 1.0 / double (uint(1) << 31); // TODO - 1 - 1
-  uint s = GetNextUint();
-  double ret = double (s) * (inv_max_uint * scale);
-  return ret;
+  uint done = 0;
+  while (n - done >= kChunk) {
+    reps (ii, kLanes, kChunk + kLanes) {
+      states [ii] = states [ii - kLanes] * lane_mult + lane_plus;
+    }
+    uint* chunk_out = out + done;
+    rep (ii, kChunk) chunk_out [ii] = Output (states [ii]);
+    rep (ii, kLanes) states [ii] = states [kChunk + ii];
+    done += kChunk;
+  }
+  state = states [0];
+  reps (ii, done, n) out [ii] = GetNextUint ();
 }
 
-/*
-// TODO move it to test
-void FastRandom::test () {
-  uint start = GetNextUint ();
-
-  uint n = 1;
-  uint max = 0;
-  uint sum = start;
-
-  while (true) {
-    uint r = GetNextUint ();
-    if (r == start) break;
-    n++;
-    sum += r;
-    if (max < r) max = r;
+// Brown, "Random Number Generation with Arbitrary Stride".
+void FastRandom::Advance (uint64 delta) {
+  uint64 cur_mult = kMultiplier;
+  uint64 cur_plus = increment;
+  uint64 acc_mult = 1;
+  uint64 acc_plus = 0;
+  while (delta > 0) {
+    if (delta & 1) {
+      acc_mult *= cur_mult;
+      acc_plus = acc_plus * cur_mult + cur_plus;
+    }
+    cur_plus = (cur_mult + 1) * cur_plus;
+    cur_mult *= cur_mult;
+    delta >>= 1;
   }
-  printf ("n = %d\n", n);
-  printf ("max = %d\n", max);
-  printf ("sum = %d\n", sum);
+  state = acc_mult * state + acc_plus;
 }
 
-void FastRandom::test2 (uint k, uint n) {
+// Former test2, with the bucket counts reduced to chi-square.
+double FastRandom::BucketChiSquare (uint k, uint n) {
   uint* bucket = new uint[k];
 
   rep (ii, k)  bucket [ii] = 0;
@@ -84,7 +92,27 @@ void FastRandom::test2 (uint k, uint n) {
     ASSERT (r < k);
     bucket [r] ++;
   }
-  rep (ii, k)  printf ("%d\n", bucket [ii]);
+  double expected = double (n) / k;
+  double chi2 = 0.0;
+  rep (ii, k) {
+    double d = bucket [ii] - expected;
+    chi2 += d * d / expected;
+  }
   delete[] bucket;
+  return chi2;
+}
+
+double FastRandom::SerialCorrelation (uint n) {
+  double sum = 0.0, sum2 = 0.0, sum_lag = 0.0;
+  double first = NextDouble ();
+  double prev = first;
+  rep (ii, n) {
+    double x = ii + 1 < n ? NextDouble () : first;
+    sum += prev;
+    sum2 += prev * prev;
+    sum_lag += prev * x;
+    prev = x;
+  }
+  double mean = sum / n;
+  return (sum_lag / n - mean * mean) / (sum2 / n - mean * mean);
 }
-*/
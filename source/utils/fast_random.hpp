@@ -6,22 +6,70 @@
 #define FAST_RANDOM_
 
 #include "utils.hpp"
+#include "test.hpp"
 
-class FastRandom {             // Park - Miller "minimal standard"
+// PCG32 (XSH-RR output of a 64 bit LCG), see pcg-random.org.
+// Generators with different streams are independent, Advance jumps
+// over any number of values in O(log) time.
+class FastRandom {
 public:
 
   FastRandom ();
   FastRandom (uint seed);
-  void SetSeed (uint seed);
-  uint GetSeed ();
+  FastRandom (uint seed, uint stream);
+  void SetSeed (uint seed);    // keeps the stream
+  uint GetSeed ();             // as given to the constructor or SetSeed
 
-  uint GetNextUint ();
-  uint GetNextUint (uint n);   // n must be between 1 .. (1<<16) + 1
+  uint GetNextUint ();         // 0 .. 2^32 - 1
+  uint GetNextUint (uint n) {  // 0 .. n-1, unbiased, n > 0
+    ASSERT (n > 0);
+    // Lemire's multiply and reject, the division is almost never needed.
+    uint64 m = uint64 (GetNextUint ()) * n;
+    if (uint (m) < n) {
+      uint threshold = -n % n;
+      while (uint (m) < threshold) m = uint64 (GetNextUint ()) * n;
+    }
+    return m >> 32;
+  }
 
-  double NextDouble ();
-  double NextDouble (double scale);
+  double NextDouble () {       // [0, 1)
+    return GetNextUint () * kInvTwoPow32;
+  }
+
+  double NextDouble (double scale) {
+    return GetNextUint () * (kInvTwoPow32 * scale);
+  }
+
+  // Same values as n calls of GetNextUint ().
+  void Fill (uint* out, uint n);
+
+  // Skips delta values.
+  void Advance (uint64 delta);
+
+  // Quality checks. Chi-square of GetNextUint (k) counts in n draws
+  // (k - 1 degrees of freedom) and lag 1 correlation of n doubles.
+  double BucketChiSquare (uint k, uint n);
+  double SerialCorrelation (uint n);
+
+private:
+  static const uint64 kMultiplier = 6364136223846793005ULL;
+  static constexpr double kInvTwoPow32 = 1.0 / 4294967296.0;
+
+  static uint Output (uint64 state) {
+    uint xorshifted = uint (((state >> 18) ^ state) >> 27);
+    uint rot = state >> 59;
+    return (xorshifted >> rot) | (xorshifted << ((-rot) & 31));
+  }
 
   uint seed;
+  uint64 state;
+  uint64 increment;            // odd, selects the stream
 };
 
+inline uint FastRandom::GetNextUint () {
+  uint64 old = state;
+  state = old * kMultiplier + increment;
+  return Output (old);
+}
+
 #endif
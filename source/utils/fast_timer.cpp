@@ -15,6 +15,14 @@
 #pragma intrinsic(__rdtsc)
 #endif
 
+#ifdef __linux__
+#include <cstring>
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
 #include <iostream>
 #include <cstdlib>
 
@@ -48,6 +56,17 @@ uint64 FastTimer::GetCcTime () {
 }
 
 
+double FastTimer::MinOverhead () {
+  double overhead = 1.0E20;
+  for (int ii = 0; ii < 1000; ii++) {
+    uint64 t1 = GetCcTime ();
+    uint64 t2 = GetCcTime ();
+    overhead = min (overhead, double (t2 - t1));
+  }
+  return overhead;
+}
+
+
 void FastTimer::Reset () {
   sample_cnt = 0;
   sample_sum = 0;
@@ -80,6 +99,115 @@ string FastTimer::ToString (float unit) {
 }
 
 
+// -----------------------------------------------------------------------------
+
+namespace {
+  const char* const kEventNames [PerfCounters::kEventCount] = {
+    "cycles", "instructions", "L1d misses", "LLC misses", "branch misses"
+  };
+
+#ifdef __linux__
+  int OpenPerfEvent (uint32_t type, uint64_t config) {
+    perf_event_attr attr;
+    memset (&attr, 0, sizeof (attr));
+    attr.size = sizeof (attr);
+    attr.type = type;
+    attr.config = config;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+    return syscall (__NR_perf_event_open, &attr, 0, -1, -1, 0);
+  }
+#endif
+}
+
+
+PerfCounters::PerfCounters () {
+  rep (ii, kEventCount) fd [ii] = -1;
+#ifdef __linux__
+  const uint64_t l1d_miss =
+    PERF_COUNT_HW_CACHE_L1D |
+    (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+    (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+  fd [Cycles]       = OpenPerfEvent (PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES);
+  fd [Instructions] = OpenPerfEvent (PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS);
+  fd [L1dMisses]    = OpenPerfEvent (PERF_TYPE_HW_CACHE, l1d_miss);
+  fd [LlcMisses]    = OpenPerfEvent (PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES);
+  fd [BranchMisses] = OpenPerfEvent (PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES);
+#endif
+  Reset ();
+}
+
+
+PerfCounters::~PerfCounters () {
+#ifdef __linux__
+  rep (ii, kEventCount) if (fd [ii] >= 0) close (fd [ii]);
+#endif
+}
+
+
+bool PerfCounters::Has (Event e) const {
+  return e == Cycles || fd [e] >= 0;
+}
+
+
+bool PerfCounters::HasHardware () const {
+  return fd [Instructions] >= 0;
+}
+
+
+void PerfCounters::Reset () {
+  rep (ii, kEventCount) sum [ii] = 0.0;
+}
+
+
+// Multiplexed counters are scaled by time enabled / time running.
+double PerfCounters::Read (int ii) const {
+  if (ii == Cycles && fd [ii] < 0) return FastTimer::GetCcTime ();
+#ifdef __linux__
+  uint64_t data [3]; // value, time enabled, time running
+  if (fd [ii] < 0 || read (fd [ii], data, sizeof (data)) != sizeof (data)) return 0.0;
+  if (data [2] == 0) return 0.0;
+  return double (data [0]) * data [1] / data [2];
+#else
+  return 0.0;
+#endif
+}
+
+
+void PerfCounters::Start () {
+  rep (ii, kEventCount) start [ii] = Read (ii);
+}
+
+
+void PerfCounters::Stop () {
+  rep (ii, kEventCount) sum [ii] += Read (ii) - start [ii];
+}
+
+
+double PerfCounters::Count (Event e) const {
+  return sum [e];
+}
+
+
+string PerfCounters::ToString (double op_cnt, const string& op_name) const {
+  ostringstream s;
+  if (!HasHardware ()) {
+    s << Count (Cycles) / op_cnt << " CC/" << op_name
+      << " (rdtsc, no hardware counters)" << endl;
+    return s.str ();
+  }
+  s << Count (Instructions) / Count (Cycles) << " IPC" << endl;
+  rep (ii, kEventCount) {
+    if (!Has (Event (ii))) continue;
+    s << Count (Event (ii)) / op_cnt << " " << kEventNames [ii]
+      << "/" << op_name << endl;
+  }
+  return s.str ();
+}
+
+// -----------------------------------------------------------------------------
+
 int TimeSeed () {
   FastTimer timer;
   return (int)timer.GetCcTime();
@@ -112,6 +240,16 @@ float ProcessUserTime () {
 # endif
 }
 
+double WallTime () {
+# if defined(_MSC_VER) || defined(__MINGW32__)
+  return GetTickCount () / 1000.0;
+# else
+  timeval tv;
+  gettimeofday (&tv, NULL);
+  return tv.tv_sec + tv.tv_usec / 1000000.0;
+# endif
+}
+
 // TODO use this to port rusage to windows/mingw
 // http://octave.sourceforge.net/doxygen/html/getrusage_8cc-source.html
 // http://stackoverflow.com/questions/771944/how-to-measure-user-time-used-by-process-on-windows
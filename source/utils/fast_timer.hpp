@@ -19,13 +19,52 @@ public:
 public:
   static uint64 GetCcTime ();
 
+  // Minimal cost of a GetCcTime pair, a robust overhead for timing
+  // short pieces of code.
+  static double MinOverhead ();
+
   double  sample_cnt;
   double  sample_sum;
   uint64  start_time;
   double  overhead;
 };
 
+// Hardware counters of the calling thread over measured regions, from
+// perf_event_open (Linux). When the syscall is unavailable (other
+// systems, no PMU in a VM, perf_event_paranoid) only Cycles is
+// counted, by rdtsc.
+class PerfCounters {
+public:
+  enum Event { Cycles, Instructions, L1dMisses, LlcMisses, BranchMisses, kEventCount };
+
+  PerfCounters ();
+  ~PerfCounters ();
+
+  bool Has (Event e) const;
+  bool HasHardware () const; // at least instructions are counted
+
+  void Reset ();
+  void Start ();
+  void Stop (); // adds the region to the sums
+
+  double Count (Event e) const;
+
+  // IPC and events per op, op_name is e.g. "move".
+  std::string ToString (double op_cnt, const std::string& op_name) const;
+
+private:
+  PerfCounters (const PerfCounters&);
+  void operator= (const PerfCounters&);
+
+  double Read (int ii) const;
+
+  int    fd    [kEventCount]; // -1 - not counted
+  double start [kEventCount];
+  double sum   [kEventCount];
+};
+
 float ProcessUserTime ();
+double WallTime ();
 int TimeSeed ();
 
 